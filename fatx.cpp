@@ -21,11 +21,13 @@
 const char*		sepdir		= "/";				/// using unix directories
 const char*		fsid		= "XTAF";			/// filesystem id
 const char*		fidx		= "name.txt";		/// file used for label name
+const char*		snapid		= "XTAFSNAP";		/// tree snapshot file id
 const char*		def_landf	= "lost+found";		/// default directory for lost & founds
 const char*		def_fpre	= "FILE";			/// default file prefix for lost & founds
 const char*		def_label	= "XBOX";			/// default label name
 
 fatx_context*	fatx_context::	fatxc = nullptr;
+bool			console::		piped = false;
 
 template<typename key_t, typename value_t>
 												read_cache<key_t, value_t>::	read_cache(const fread_t& r, const fwrite_t& w, size_t c, size_t a) :
@@ -44,6 +46,13 @@ void											read_cache<key_t, value_t>::	clear() {
 	container.clear();
 }
 template<typename key_t, typename value_t>
+void											read_cache<key_t, value_t>::	forget(const key_type& b, const key_type& e) {
+	#ifndef NO_LOCK
+		scoped_lock<mutex> lock(access);
+	#endif
+	container.left.erase(container.left.lower_bound(b), container.left.lower_bound(e));
+}
+template<typename key_t, typename value_t>
 typename read_cache<key_t, value_t>::value_type	read_cache<key_t, value_t>::	operator () (const key_type& k) {
 	#ifndef NO_LOCK
 		scoped_lock<mutex> lock(access);
@@ -251,27 +260,48 @@ string						vareas::		print() const {
 }
 #endif
 
-							buffer::		buffer(const streamptr o, const streamptr s) : touched(false), offset(0) {
+clusptr						chainidx::		seek(clusptr& r, const clusptr& orig) {
+	#ifndef NO_LOCK
+		sharable_lock<mutex> lock(access);
+	#endif
+	map<clusptr, clusptr>::const_iterator i = jumps.upper_bound(r);
+	if(i == jumps.begin()) {
+		r = 0;
+		return orig;
+	}
+	i--;
+	r = i->first;
+	return i->second;
+}
+void						chainidx::		mark(const clusptr& r, const clusptr& c) {
+	if(r == 0 || (r % jmp_step) != 0)
+		return;
+	#ifndef NO_LOCK
+		scoped_lock<mutex> lock(access);
+	#endif
+	jumps[r] = c;
+}
+void						chainidx::		cut(const clusptr& r) {
+	#ifndef NO_LOCK
+		scoped_lock<mutex> lock(access);
+	#endif
+	jumps.erase(jumps.lower_bound(r), jumps.end());
+}
+void						chainidx::		clear() {
+	#ifndef NO_LOCK
+		scoped_lock<mutex> lock(access);
+	#endif
+	jumps.clear();
+}
+
+							buffer::		buffer(const streamptr o, const streamptr s) : touched(false), offset(0), stamp(0), gen(0) {
 	if(s == 0) {
 		#if defined DEBUG && defined DBG_BUFFER
 			dbglog((format("... buffer: empty allocation try\n")).str())
 		#endif
 		return;
 	}
-	size_t siz = min<streamptr>((const streamptr)max_buf, s);
-	while(true) {
-		resize(siz);
-		if(size() >= siz)
-			break;
-		siz /= 2;
-		if(siz < fatx_context::get()->par.clus_size) {
-			clear();
-			#if defined DEBUG && defined DBG_BUFFER
-				dbglog((format("... buffer: no way to alloc 0x%08X 0x%016X %d\n") % &(*this)[0] % offset % siz).str())
-			#endif
-			return;
-		}
-	}
+	resize(s);
 	offset = o;
 	#if defined DEBUG && defined DBG_BUFFER
 		dbglog((format(".oO buffer: 0x%08X 0x%016X %d\n") % this % offset % (*this).size()).str())
@@ -282,16 +312,6 @@ string						vareas::		print() const {
 		dbglog((format("Oo. buffer: 0x%08X 0x%016X %d\n") % this % offset % (*this).size()).str())
 	#endif
 }
-void						buffer::		enlarge(const streamptr s) {
-	if(s > max_buf)
-		return;
-	resize(s);
-	if(size() < s)
-		return;
-	#if defined DEBUG && defined DBG_BUFFER
-		dbglog((format("OOO buffer: 0x%08X 0x%016X %d\n") % this % offset % (*this).size()).str())
-	#endif
-}
 #if defined DEBUG && defined DBGBUFDMP
 void						buffer::		operator () (size_t p) {
 	string res;
@@ -433,10 +453,31 @@ void						mutex::			genunlockandlockupgradable(function<void()> ulalup) {
 		#endif
 	}
 }
+void						mutex::			genunlockandlocksharable(function<void()> ulals) {
+	if(fatx_context::get()->mmi.prog == frontend::fuse) {
+		#if defined DEBUG && defined DBG_SEM
+			#ifdef DBGSEM
+				if(nam == DBGSEM)
+			#endif
+			dbglog((format("<<< Lock release [X->S-%s]\n") % nam).str())
+		#endif
+		#ifndef NO_LOCK
+			ulals();
+		#else
+			(void) ulals;
+		#endif
+		#if defined DEBUG && defined DBG_SEM
+			#ifdef DBGSEM
+				if(nam == DBGSEM)
+			#endif
+			dbglog((format("    done [%s].\n") % nam).str())
+		#endif
+	}
+}
 
 #ifndef ENABLE_XBOX
 void						console::		write(const string s, bool err) {
-	(err ? cerr : cout) << s;
+	(err || piped ? cerr : cout) << s;
 }
 pair<bool, bool>			console::		read() {
 	char c, d;
@@ -459,6 +500,8 @@ int							fatx_context::	setup() {
 		return res;
 	if((res = par.setup()))
 		return res;
+	if((res = pool.setup()))
+		return res;
 	if(mmi.prog == frontend::fsck || mmi.prog == frontend::unrm || (mmi.prog == frontend::fuse && mmi.recover))
 		fat = new memmap(par);
 	else
@@ -468,6 +511,8 @@ int							fatx_context::	setup() {
 	#if defined DEBUG && defined DBG_INIT
 		dbglog("::EOMAP\n")
 	#endif
+	if(mmi.prog == frontend::fuse && !mmi.recover && !mmi.snapdir.empty())
+		snap.load();
 	if(mmi.prog != frontend::mkfs) {
 		root = new entry();
 		if(root == nullptr)
@@ -479,8 +524,21 @@ int							fatx_context::	setup() {
 	return res;
 }
 void						fatx_context::	destroy() {
+	prefetch.stop();
+	writeback.stop();
+	dclus.stop();
+	dclus.flush();
+	notify.stop();
+	dcache.clear();
+	nodes.clear();
+	const bool snapped = root != nullptr && mmi.prog == frontend::fuse && !mmi.recover && !mmi.snapdir.empty();
+	if(snapped)
+		snap.keep(root);
 	delete root;
 	root = nullptr;
+	dclus.flush();
+	if(snapped)
+		snap.save();
 	delete fat;
 	fat = nullptr;
 }
@@ -489,7 +547,8 @@ void						fatx_context::	destroy() {
 							frontend::		frontend(int ac, const char* const * const av) :
 	readonly(false),		prog(unknown),			force_y(false),			force_n(false),			force_a(false),
 	verbose(false),			recover(false),			local(false),			deldate(true),			dellost(true),
-	fuse_debug(false),		fuse_foregrd(false),	fuse_singlethr(false),	nofat(false),			cutname(false),
+	fuse_debug(false),		fuse_foregrd(false),	fuse_singlethr(false),	fuse_lowlevel(false),	fuse_threads(0),
+	fuse_timeout(def_ll_timeout),					nofat(false),			cutname(false),
 	argc(ac),				argv(av),				progname(av[0]),		dialog(true),			lostfound(def_landf),
 	foundfile(def_fpre),	filecount(0),			mount(),				volname(),				fuse_option(),
 	unkopt(),				partition("x2"),		table(),				clus_size(0),			uid(getuid()),
@@ -502,7 +561,12 @@ void						fatx_context::	destroy() {
 		#else
 			0
 		#endif
-	), allyes(true), offset(0), size(0), input(), script() {
+	), allyes(true), offset(0), size(0), cache_size(def_cache), snapdir(), dirsync("delay"), input(), script(), populate(), tardir() {
+	// tree snapshots go with the other caches of the user
+	if(getenv("XDG_CACHE_HOME") != nullptr)
+		snapdir = string(getenv("XDG_CACHE_HOME")) + "/fatx";
+	else if(getenv("HOME") != nullptr)
+		snapdir = string(getenv("HOME")) + "/.cache/fatx";
 }
 bool						frontend::		getanswer(bool def) {
 	bool res = false;
@@ -538,6 +602,8 @@ bool						frontend::		getanswer(bool def) {
 	partition.clear();
 	input.clear();
 	script.clear();
+	populate.clear();
+	tardir.clear();
 }
 string						frontend::		name() {
 	return
@@ -671,9 +737,20 @@ int							frontend::		setup() {
 			("debug,d", "enable debug output (implies -f)")
 			("foregrd,f", "foreground operation")
 			("singlethr,s", "fuse on single thread")
+			("lowlevel", "use the low level fuse interface, with inode numbers")
+			("threads", value<unsigned int>(), "fuse worker threads kept waiting for requests (libfuse 3)")
+			("timeout", value<unsigned int>(), "seconds the kernel keeps attributes and names (low level interface)")
 			("uid",  value<uid_t>(), "sets uid of the filesystem")
 			("gid",  value<gid_t>(), "sets gid of the filesystem")
 			("mask",  value<string>(), "sets mask for entries modes")
+			("cache-size", value<streamptr>(), "memory for file caches in MB")
+			("snapshot", value<string>(), "directory of tree snapshots, empty to disable")
+			("sync", value<string>(),
+				"write of directory changes:\n"
+				"\"always\" at once,\n"
+				"\"close\" at close of files,\n"
+				"\"delay\" some seconds later (default)"
+			)
 		;
 	}
 	if(prog == label || prog == mkfs) {
@@ -681,9 +758,15 @@ int							frontend::		setup() {
 			("label,l", value<string>(), "set volume name")
 		;
 	}
+	if(prog == label) {
+		visible.add_options()
+			("tar", value<string>(), "write a tar stream of a directory to the standard output")
+		;
+	}
 	if(prog == mkfs) {
 		visible.add_options()
 			("cls-size,c", value<streamptr>(), "set num of blocks per cluster")
+			("populate", value<string>(), "copy a host directory in the new filesystem, \"-\" for a tar stream on the standard input")
 			("table,b", value<string>(),
 				"select partition table:\n"
 				"\"mu\"   for Memory Unit,\n"
@@ -801,6 +884,12 @@ int							frontend::		setup() {
 	}
 	if(varmap.count("singlethr"))
 		fuse_singlethr	= true;
+	if(varmap.count("lowlevel"))
+		fuse_lowlevel	= true;
+	if(varmap.count("threads"))
+		fuse_threads	= varmap["threads"].as<unsigned int>();
+	if(varmap.count("timeout"))
+		fuse_timeout	= varmap["timeout"].as<unsigned int>();
 	if(varmap.count("foregrd"))
 		fuse_foregrd	= true;
 	if(varmap.count("mount"))
@@ -826,6 +915,35 @@ int							frontend::		setup() {
 		offset			= varmap["offset"].as<streamptr>();
 	if(varmap.count("size"))
 		size			= varmap["size"].as<streamptr>();
+	if(varmap.count("cache-size"))
+		cache_size		= varmap["cache-size"].as<streamptr>();
+	if(varmap.count("snapshot"))
+		snapdir			= varmap["snapshot"].as<string>();
+	if(varmap.count("populate"))
+		populate		= varmap["populate"].as<string>();
+	if(varmap.count("tar")) {
+		tardir			= varmap["tar"].as<string>();
+		console::piped	= true;
+	}
+	if(populate == "-" && !varmap.count("all") && !varmap.count("none") && !varmap.count("auto")) {
+		// the questions would be answered by the tar stream
+		console::write("A tar stream on the standard input needs an answer to everything (-y, -n or -a).\n");
+		prog = unknown;
+	}
+	if(varmap.count("sync")) {
+		dirsync			= varmap["sync"].as<string>();
+		if(dirsync != "always" && dirsync != "close" && dirsync != "delay") {
+			console::write("Invalid sync mode: " + dirsync + "\n");
+			prog = unknown;
+		}
+	}
+	if(!snapdir.empty() && snapdir.compare(0, strlen(sepdir), sepdir) != 0) {
+		// fuse leaves the current directory when going in background
+		char* cwd = getcwd(nullptr, 0);
+		if(cwd != nullptr)
+			snapdir = string(cwd) + sepdir + snapdir;
+		free(cwd);
+	}
 	if(varmap.count("input"))
 		input			= varmap["input"].as<string>();
 	if(prog == label)
@@ -870,9 +988,17 @@ int							frontend::		setup() {
 			(format("fuse debug\t%d\n")		% fuse_debug).str() +
 			(format("fuse foregrd\t%d\n")	% fuse_foregrd).str() +
 			(format("fuse singlethr\t%d\n")	% fuse_singlethr).str() +
+			(format("fuse lowlevel\t%d\n")	% fuse_lowlevel).str() +
+			(format("fuse threads\t%d\n")	% fuse_threads).str() +
+			(format("fuse timeout\t%d\n")	% fuse_timeout).str() +
 			(format("uid\t\t%d\n")			% uid).str() +
 			(format("gid\t\t%d\n")			% gid).str() +
-			(format("mask\t\t%03o\n")		% mask).str()
+			(format("mask\t\t%03o\n")		% mask).str() +
+			(format("cache size\t%d\n")	% cache_size).str() +
+			(format("snapshot\t%s\n")		% snapdir).str() +
+			(format("sync\t\t%s\n")			% dirsync).str() +
+			(format("populate\t%s\n")		% populate).str() +
+			(format("tar\t\t%s\n")			% tardir).str()
 		);
 		return EPERM;
 	}
@@ -888,6 +1014,17 @@ int							frontend::		setup() {
 	#endif
 	return 0;
 }
+static bool					scriptadd		(entry* d, entry* n) {
+	// a name already taken, in any case, is refused and the clusters of the new entry go back
+	if(int res = d->addtodir(n)) {
+		console::write(res == EEXIST ? "exists\n" : "failed\n");
+		if(n->cluster != FLK && n->cluster != EOC)
+			fatx_context::get()->fat->free(n->cluster);
+		delete n;
+		return false;
+	}
+	return true;
+}
 void						frontend::		parser() {
 	#ifndef ENABLE_XBOX
 		script.erase(remove_if(script.begin(), script.end(), [] (const char c) ->bool { return c == ' ' || c == '\t' || c == '\n'; }), script.end());
@@ -916,7 +1053,8 @@ void						frontend::		parser() {
 					console::write("nothing\n");
 					continue;
 				}
-				s->addtodir(n);
+				if(!scriptadd(s, n))
+					continue;
 				console::write(n->path() + "\n");
 			}
 			else if(*i == "rmdir" && ++i != args.end() && !i->empty()) {
@@ -930,7 +1068,8 @@ void						frontend::		parser() {
 					console::write("nothing\n");
 					continue;
 				}
-				if(n->childs.size() != 0) {
+				n->load();
+				if(n->entries() != 0) {
 					console::write("not empty\n");
 					continue;
 				}
@@ -944,7 +1083,7 @@ void						frontend::		parser() {
 					continue;
 				}
 				entry* s = fatx_context::get()->root->find(&(*i++)[0]);
-				if(s == nullptr) {
+				if(s == nullptr || s->flags.dir) {
 					console::write("nothing\n");
 					continue;
 				}
@@ -958,11 +1097,14 @@ void						frontend::		parser() {
 					console::write("nothing\n");
 					continue;
 				}
+				// the whole chain is allocated at once, then filled extent to extent
 				entry* n = new entry(i->substr(l + 1), s->size);
-				d->addtodir(n);
-				string b(s->size, '\0');
-				s->data(&b[0], true, 0, s->size);
-				n->data(&b[0], false, 0, n->size);
+				if(!scriptadd(d, n))
+					continue;
+				if(n->copy(*s, 0, 0, s->size) < 0) {
+					console::write("failed\n");
+					continue;
+				}
 				console::write(n->path() + "\n");
 			}
 			else if(*i == "rcp" && ++i != args.end() && !i->empty()) {
@@ -985,14 +1127,20 @@ void						frontend::		parser() {
 					console::write("nothing\n");
 					continue;
 				}
+				// the chain is allocated from the size, then filled while the next chunk is read
 				entry* n = new entry(i->substr(l + 1), size);
-				d->addtodir(n);
-				string b(size, '\0');
-				s.read(&b[0], size);
-				s.close();
+				if(!scriptadd(d, n))
+					continue;
 				console::write((format("(%d)") % size).str());
-				n->data(&b[0], false, 0, n->size);
-				console::write(n->path() + "\n");
+				int res = streamer::copy(size, [&s] (char* b, filesize o, size_t c) -> int {
+					s.seekg(o, ios::beg);
+					s.read(b, c);
+					return s ? 0 : EIO;
+				}, [n] (char* b, filesize o, size_t c) -> int {
+					return n->data(b, false, o, c);
+				});
+				s.close();
+				console::write(res ? string("failed\n") : n->path() + "\n");
 			}
 			else if(*i == "lcp" && ++i != args.end() && !i->empty()) {
 				console::write("lcp:");
@@ -1010,12 +1158,27 @@ void						frontend::		parser() {
 				}
 				ofstream d(&(*i)[0], ios::binary);
 				d.seekp(0, ios::beg);
-				string b(s->size, '\0');
-				s->data(&b[0], true, 0, s->size);
 				console::write((format("(%d)") % s->size).str());
-				d.write(&b[0], s->size);
+				int res = streamer::copy(s->size, [s] (char* b, filesize o, size_t c) -> int {
+					return s->data(b, true, o, c);
+				}, [&d] (char* b, filesize, size_t c) -> int {
+					d.write(b, c);
+					return d ? 0 : EIO;
+				});
 				d.close();
-				console::write(*i + "\n");
+				console::write(res ? string("failed\n") : *i + "\n");
+			}
+			else if(*i == "export" && ++i != args.end() && !i->empty()) {
+				console::write("export:");
+				entry* s = fatx_context::get()->root->find(&(*i++)[0]);
+				if(s == nullptr || !s->flags.dir) {
+					console::write("nothing\n");
+					continue;
+				}
+				exporter e;
+				int res = e.extract(s, *i);
+				console::write((format("(%d)") % e.count()).str());
+				console::write(res ? string("failed\n") : *i + "\n");
 			}
 			else if(*i == "mv" && ++i != args.end() && !i->empty()) {
 				console::write("mv:");
@@ -1274,10 +1437,17 @@ int							device::		write(const streamptr& p, const string& s) {
 	#ifndef NO_WRITE
 		#ifndef NO_IO
 			io->write(&s[0], s.size());
+			#if !defined NO_PIO || !defined NO_SPLICE
+				// positioned reads and splices do not see the stream buffer
+				io->flush();
+			#endif
 			status = io->bad() || io->fail();
 		#endif
 		#if !defined NO_FD && defined NO_IO
 			fwrite(&s[0], s.size(), 1, fd);
+			#if !defined NO_PIO || !defined NO_SPLICE
+				fflush(fd);
+			#endif
 			status = (ferror(fd) != 0);
 		#endif
 		changes = true;
@@ -1294,6 +1464,107 @@ int							device::		write(const streamptr& p, const string& s) {
 	}
 	return 0;
 }
+int							device::		read(const streamptr& p, char* b, const size_t s) {
+	if(s == 0)
+		return 0;
+	if(size() && p + s > size()) {
+		console::write((format("Blocks out of bounds ([0x%016X ; 0x%016X] > 0x%016X).\n") % p % (p + s - 1) % size()).str(), true);
+		return EOVERFLOW;
+	}
+	#if !defined NO_PIO && !defined NO_FD
+		// straight to the caller buffer, and without the device lock
+		if(fd) {
+			for(size_t n = 0; n < s;) {
+				ssize_t r = pread(fileno(fd), b + n, s - n, p + n);
+				if(r < 0 && errno == EINTR)
+					continue;
+				if(r <= 0) {
+					console::write((format("Unreadable block at 0x%016X.\n") % (p + n)).str(), true);
+					return EIO;
+				}
+				n += r;
+			}
+			#if defined DEBUG && defined DBG_READ
+				devlog(true, p, string(b, s));
+			#endif
+			return 0;
+		}
+	#endif
+	string res = read(p, s);
+	if(res.size() != s)
+		return EIO;
+	memcpy(b, &res[0], s);
+	return 0;
+}
+int							device::		write(const streamptr& p, const char* b, const size_t s) {
+	if(s == 0)
+		return 0;
+	if(p + s > size()) {
+		console::write((format("Blocks out of bounds ([0x%016X;0x%016X] > 0x%016X).\n") % p % (p + s - 1) % size()).str(), true);
+		return EOVERFLOW;
+	}
+	if(!fatx_context::get()->mmi.writeable())
+		return 0;
+	#if !defined NO_PIO && !defined NO_FD
+		if(fd) {
+			#if defined DEBUG && defined DBG_WRITE
+				devlog(false, p, string(b, s));
+			#endif
+			#ifndef NO_WRITE
+				for(size_t n = 0; n < s;) {
+					ssize_t w = pwrite(fileno(fd), b + n, s - n, p + n);
+					if(w < 0 && errno == EINTR)
+						continue;
+					if(w <= 0) {
+						console::write((format("Unwriteable block at 0x%016X.\n") % (p + n)).str(), true);
+						return EIO;
+					}
+					n += w;
+				}
+				changes = true;
+			#endif
+			return 0;
+		}
+	#endif
+	return write(p, string(b, s));
+}
+int							device::		copy(const streamptr& from, const streamptr& to, const size_t s) {
+	if(s == 0)
+		return 0;
+	if(from + s > size() || to + s > size()) {
+		console::write((format("Blocks out of bounds ([0x%016X;0x%016X] > 0x%016X).\n") % to % (to + s - 1) % size()).str(), true);
+		return EOVERFLOW;
+	}
+	if(!fatx_context::get()->mmi.writeable())
+		return 0;
+	size_t n = 0;
+	#if !defined NO_PIO && !defined NO_FD && !defined NO_WRITE && defined HAVE_COPY_FILE_RANGE
+		// the kernel moves the data inside the image, sharing blocks when its file system can
+		if(fd) {
+			while(n < s) {
+				loff_t i = from + n;
+				loff_t o = to + n;
+				ssize_t c = copy_file_range(fileno(fd), &i, fileno(fd), &o, s - n, 0);
+				if(c < 0 && errno == EINTR)
+					continue;
+				if(c <= 0)
+					break;
+				n += c;
+				changes = true;
+			}
+		}
+	#endif
+	// what the kernel could not copy goes through memory
+	string b(min<size_t>(s - n, cp_chunk), '\0');
+	for(size_t c; n < s; n += c) {
+		c = min<size_t>(s - n, b.size());
+		if(int res = read(from + n, &b[0], c))
+			return res;
+		if(int res = write(to + n, &b[0], c))
+			return res;
+	}
+	return 0;
+}
 int							device::		setup() {
 	bool err = false;
 	#ifndef NO_IO
@@ -1796,6 +2067,44 @@ vareas						dskmap::		getareas(const clusptr& orig, lbdarea_t lbd) {
 	#endif
 	return res;
 }
+vareas						dskmap::		getareas(const clusptr& orig, chainidx& idx, filesize s, filesize o) {
+	vareas res;
+	if(s == 0 || orig == EOC || orig == FLK)
+		return res;
+	#ifndef NO_LOCK
+		sharable_lock<mutex> lock(authm);
+	#endif
+	const clusptr first	= o >> fatx_context::get()->par.clus_pow;
+	const clusptr last	= (o + s - 1) >> fatx_context::get()->par.clus_pow;
+	// we start from the nearest known cluster before offset
+	clusptr rank = first;
+	clusptr cur_cls = idx.seek(rank, orig);
+	while(true) {
+		if(rank >= first) {
+			filesize cls_off	= (filesize)rank << fatx_context::get()->par.clus_pow;
+			filesize beg		= max<filesize>(o, cls_off);
+			filesize end		= min<filesize>(o + s, cls_off + fatx_context::get()->par.clus_size);
+			if(!res.empty() && res.back().stop + 1 == cur_cls) {
+				res.back().size	+= end - beg;
+				res.back().stop	= cur_cls;
+			}
+			else
+				res.push_back(area(beg, clsarithm::cls2ptr(cur_cls) + (beg - cls_off), end - beg, cur_cls, cur_cls));
+		}
+		if(rank == last)
+			break;
+		cur_cls = read(cur_cls);
+		if(cur_cls == EOC || cur_cls == FLK) {
+			console::write((format("FAT chain starting at 0x%08X shorter than expected.\n") % orig).str(), true);
+			return vareas();
+		}
+		idx.mark(++rank, cur_cls);
+	}
+	#if defined DEBUG && defined DBG_AREAS
+		dbglog("Seek" + res.print())
+	#endif
+	return res;
+}
 clusptr						dskmap::		clsavail() {
 	clusptr res = 0;
 	if(freegaps.empty())
@@ -1873,6 +2182,28 @@ int							dskmap::		write(const clusptr& p, const clusptr& v) {
 	}
 	return memnext(p, v);
 }
+int							dskmap::		link(const clusptr& p, const clusptr& s) {
+	// a contiguous chain goes to the FAT in one write, instead of one per cluster
+	if(s == 0)
+		return 0;
+	if(p < 1 || p + s - 1 > fatx_context::get()->par.clus_fat) {
+		console::write((format("Cluster pointer to FAT out of bounds (0x%08X).\n") % (p + s - 1)).str(), true);
+		return EOVERFLOW;
+	}
+	string buf;
+	buf.reserve(s * fatx_context::get()->par.chain_size);
+	for(clusptr i = p; i < p + s; i++) {
+		if(fatx_context::get()->par.chain_size == 4)
+			buf += endian<4>::litend((i == p + s - 1) ? EOC : i + 1);
+		else
+			buf += endian<2>::litend((i == p + s - 1) ? EOC : i + 1);
+	}
+	// cached values are dropped once the device holds the new ones: a miss reads and caches under the lock of the cache,
+	// so an old value read before the write is forgotten here, and any read after it gets the new one
+	int res = fatx_context::get()->dev.write(clsarithm::cls2fat(p), buf);
+	memnext.forget(p, p + s);
+	return res;
+}
 vareas						dskmap::		alloc(const clusptr& s, const clusptr& o) {
 	vareas res;
 	if(s == 0)
@@ -1912,8 +2243,7 @@ vareas						dskmap::		alloc(const clusptr& s, const clusptr& o) {
 	}
 	if(gap_clus != 0) {
 		// contiguous case
-		for(clusptr i = gap_clus; i < gap_clus + s; i++)
-			write(i, (i == gap_clus + s - 1) ? EOC : i + 1);
+		link(gap_clus, s);
 		freegaps.left.erase(gap_clus);
 		if(gap_size != s)
 			freegaps.insert(gap_t::value_type(gap_clus + s, gap_size - s));
@@ -1939,25 +2269,23 @@ vareas						dskmap::		alloc(const clusptr& s, const clusptr& o) {
 				gap = freegaps.right.rbegin();
 				gap_clus = gap->second;
 				gap_size = gap->first;
+				const clusptr n = min<clusptr>(gap_size, tot_size);
+				// the last cluster of the previous gap leads to this one
 				if(old_clus != 0)
 					write(old_clus, gap_clus);
-				for(clusptr i = gap_clus; i < gap_clus + min<clusptr>(gap_size, tot_size); i++)
-					write(i, (i == gap_clus + min<clusptr>(gap_size, tot_size) - 1) ? EOC : i + 1);
+				link(gap_clus, n);
 				res.push_back(area(
 					res.empty() ? 0 : res.back().offset + res.back().size,
 					clsarithm::cls2ptr(gap_clus),
-					min<clusptr>(gap_size, tot_size) * fatx_context::get()->par.clus_size,
+					n * fatx_context::get()->par.clus_size,
 					gap_clus,
-					gap_clus + min<clusptr>(gap_size, tot_size) - 1
+					gap_clus + n - 1
 				));
-				freegaps.right.erase(gap_clus);
-				if(tot_size < gap_size) {
-					freegaps.insert(gap_t::value_type(gap_clus + gap_size, tot_size - gap_size));
-					tot_size = 0;
-				}
-				else
-					tot_size -= gap_size;
-				old_clus = gap_clus;
+				freegaps.left.erase(gap_clus);
+				if(n < gap_size)
+					freegaps.insert(gap_t::value_type(gap_clus + n, gap_size - n));
+				tot_size -= n;
+				old_clus = gap_clus + n - 1;
 			} while(tot_size != 0);
 		}
 		else {
@@ -2287,24 +2615,397 @@ void						memmap::		printfat() {
 }
 #endif
 
+							bufpool::		bufpool() : budget(0), pgsiz(pg_size), total(0), clock(0), dirt(0), access("pool") {
+}
+							bufpool::		~bufpool() {
+	spare.clear();
+	caches.clear();
+}
+int							bufpool::		setup() {
+	pgsiz	= max<size_t>(pg_size, fatx_context::get()->par.clus_size);
+	budget	= max<size_t>(2 * pgsiz, fatx_context::get()->mmi.cache_size << 20);
+	#if defined DEBUG && defined DBG_BUFFER
+		dbglog((format("... pool: %d bytes in pages of %d\n") % budget % pgsiz).str())
+	#endif
+	return 0;
+}
+size_t						bufpool::		share() {
+	#ifndef NO_LOCK
+		sharable_lock<mutex> lock(access);
+	#endif
+	return max<size_t>(2 * pgsiz, budget / max<size_t>(1, caches.size()));
+}
+void						bufpool::		reclaim(pagecache& c) {
+	// clean pages of the coldest files first, a busy file is skipped rather than waited for
+	vector<pagecache*> cold;
+	for(pagecache* i: caches)
+		if(i != &c)
+			cold.push_back(i);
+	sort(cold.begin(), cold.end(), [] (const pagecache* a, const pagecache* b) -> bool {
+		return a->age() < b->age();
+	});
+	size_t n = 0;
+	for(pagecache* i: cold) {
+		if(n >= pool_batch)
+			break;
+		n += i->shed(spare, pool_batch - n);
+	}
+	#if defined DEBUG && defined DBG_BUFFER
+		dbglog((format("... pool: %d pages reclaimed\n") % n).str())
+	#endif
+}
+ptr_buffer					bufpool::		take(pagecache& c) {
+	#ifndef NO_LOCK
+		scoped_lock<mutex> lock(access);
+	#endif
+	if(spare.empty() && total + pgsiz > budget)
+		reclaim(c);
+	if(!spare.empty()) {
+		ptr_buffer b = std::move(spare.back());
+		spare.pop_back();
+		return b;
+	}
+	if(total + pgsiz > budget)
+		return ptr_buffer();
+	total += pgsiz;
+	return ptr_buffer(new buffer(0, pgsiz));
+}
+void						bufpool::		give(ptr_buffer b) {
+	#ifndef NO_LOCK
+		scoped_lock<mutex> lock(access);
+	#endif
+	spare.push_back(std::move(b));
+}
+void						bufpool::		enter(pagecache* c) {
+	#ifndef NO_LOCK
+		scoped_lock<mutex> lock(access);
+	#endif
+	caches.insert(c);
+}
+void						bufpool::		leave(pagecache* c) {
+	#ifndef NO_LOCK
+		scoped_lock<mutex> lock(access);
+	#endif
+	caches.erase(c);
+}
+
+							pagecache::	pagecache(entry& e, mutex& m) :
+	ent(e),
+	lock(m),
+	tick(0),
+	seen(fatx_context::get()->pool.tick()),
+	behind(false),
+	pgsiz(fatx_context::get()->pool.page()) {
+	fatx_context::get()->pool.enter(this);
+}
+							pagecache::	~pagecache() {
+	// out of the pool first, it may be shedding our pages
+	fatx_context::get()->pool.leave(this);
+	while(!pages.empty())
+		release(pages.begin());
+}
+buffer*						pagecache::	get(const filesize& i) {
+	pages_t::iterator it = pages.find(i);
+	if(it == pages.end())
+		return nullptr;
+	it->second->stamp = ++tick;
+	return it->second.get();
+}
+void						pagecache::	mark(buffer& b, bool d) {
+	if(b.touched != d)
+		fatx_context::get()->pool.dirty(d ? 1 : -1);
+	b.touched = d;
+}
+void						pagecache::	release(pages_t::iterator it) {
+	mark(*it->second, false);
+	fatx_context::get()->pool.give(std::move(it->second));
+	pages.erase(it);
+}
+buffer*						pagecache::	make(const filesize& i, const filesize& lo, const filesize& hi) {
+	// beyond its share, a file recycles its own pages
+	if(pages.size() * pgsiz >= fatx_context::get()->pool.share()) {
+		int res = evict(lo, hi);
+		if(res && res != ENOMEM)
+			return nullptr;
+	}
+	ptr_buffer b;
+	while(!(b = fatx_context::get()->pool.take(*this)))
+		if(evict(lo, hi))
+			return nullptr;
+	b->offset	= i * pgsiz;
+	b->touched	= false;
+	b->stamp	= ++tick;
+	return (pages[i] = std::move(b)).get();
+}
+int							pagecache::	evict(const filesize& lo, const filesize& hi) {
+	// least recently used page, but not one of the pages the request is using
+	pages_t::iterator old = pages.end();
+	for(pages_t::iterator it = pages.begin(); it != pages.end(); it++)
+		if((it->first < lo || it->first > hi) && (old == pages.end() || it->second->stamp < old->second->stamp))
+			old = it;
+	if(old == pages.end())
+		return ENOMEM;
+	if(old->second->touched)
+		if(int res = store(old, std::next(old)))
+			return res;
+	#if defined DEBUG && defined DBG_BUFFER
+		dbglog((format("... page cache: evict page %d of %s\n") % old->first % ent.path()).str())
+	#endif
+	release(old);
+	return 0;
+}
+size_t						pagecache::	shed(vector<ptr_buffer>& to, size_t n) {
+	if(!lock.try_lock())
+		return 0;
+	vector<pages_t::iterator> clean;
+	for(pages_t::iterator it = pages.begin(); it != pages.end(); it++)
+		if(!it->second->touched)
+			clean.push_back(it);
+	sort(clean.begin(), clean.end(), [] (const pages_t::iterator& a, const pages_t::iterator& b) -> bool {
+		return a->second->stamp < b->second->stamp;
+	});
+	n = min<size_t>(n, clean.size());
+	for(size_t i = 0; i < n; i++) {
+		to.push_back(std::move(clean[i]->second));
+		pages.erase(clean[i]);
+	}
+	lock.unlock();
+	return n;
+}
+int							pagecache::	load(const filesize& first, const filesize& last) {
+	for(filesize i = first; i <= last; i++) {
+		if(get(i) != nullptr)
+			continue;
+		buffer* b = make(i, first, last);
+		if(b == nullptr)
+			return ENOMEM;
+		filesize n = min<filesize>(pgsiz, ent.size - b->offset);
+		if(int res = ent.data(&(*b)[0], true, b->offset, n)) {
+			release(pages.find(i));
+			return res;
+		}
+		memset(&(*b)[n], 0, pgsiz - n);
+	}
+	return 0;
+}
+int							pagecache::	store(pages_t::iterator b, pages_t::iterator e) {
+	// an older copy of a page being written behind must not land after this one
+	if(any_of(b, e, [] (const pages_t::value_type& p) -> bool { return p.second->touched; }))
+		fatx_context::get()->writeback.drain(&ent);
+	for(pages_t::iterator it = b; it != e; it++) {
+		buffer& p = *it->second;
+		if(!p.touched)
+			continue;
+		// tail of the last page is beyond end of file
+		if(p.offset < ent.size)
+			if(int res = ent.data(&p[0], false, p.offset, min<filesize>(pgsiz, ent.size - p.offset)))
+				return res;
+		mark(p, false);
+	}
+	return 0;
+}
+bool						pagecache::	resident(filesize offset, filesize s) const {
+	pages_t::const_iterator it = pages.lower_bound(offset / pgsiz);
+	return it != pages.end() && it->first <= (offset + s - 1) / pgsiz;
+}
+bool						pagecache::	bypass(filesize offset, filesize s) const {
+	// large aligned requests go straight to the device
+	const filesize clus = fatx_context::get()->par.clus_size;
+	return s > fatx_context::get()->pool.share() || (offset % clus == 0 && s >= clus);
+}
+int							pagecache::	direct(char* buf, bool r, filesize offset, filesize s) {
+	pages_t::iterator b = pages.lower_bound(offset / pgsiz);
+	pages_t::iterator e = pages.upper_bound((offset + s - 1) / pgsiz);
+	if(r) {
+		// dirty pages overlapping the request first, then straight from disk
+		if(int res = store(b, e))
+			return res;
+		return ent.data(buf, true, offset, s);
+	}
+	// flushers must not write an older copy of these pages after us
+	fatx_context::get()->writeback.drain(&ent);
+	if(int res = ent.data(buf, false, offset, s))
+		return res;
+	// overlapping pages get the new data, and are clean when fully covered
+	for(pages_t::iterator it = b; it != e; it++) {
+		buffer& p = *it->second;
+		filesize lo = max<filesize>(offset, p.offset);
+		filesize hi = min<filesize>(offset + s, p.offset + pgsiz);
+		memcpy(&p[lo - p.offset], buf + lo - offset, hi - lo);
+		p.gen++;
+		if(lo == p.offset && hi == p.offset + pgsiz)
+			mark(p, false);
+	}
+	return 0;
+}
+int							pagecache::	read(char* buf, filesize offset, filesize s) {
+	seen = fatx_context::get()->pool.tick();
+	if(bypass(offset, s) && !resident(offset, s))
+		return direct(buf, true, offset, s);
+	const filesize first = offset / pgsiz;
+	const filesize last = (offset + s - 1) / pgsiz;
+	if(int res = load(first, last))
+		return res == ENOMEM ? direct(buf, true, offset, s) : res;
+	for(filesize i = first; i <= last; i++) {
+		buffer& p = *pages[i];
+		filesize b = max<filesize>(offset, p.offset);
+		filesize e = min<filesize>(offset + s, p.offset + pgsiz);
+		memcpy(buf + b - offset, &p[b - p.offset], e - b);
+		#if defined DEBUG && defined DBGBUFDMP
+			p(b - p.offset);
+		#endif
+	}
+	return 0;
+}
+int							pagecache::	peek(char* buf, filesize offset, filesize s) {
+	// with the lock shared: nothing is loaded, evicted or stored, EAGAIN asks for the exclusive path
+	seen = fatx_context::get()->pool.tick();
+	if(!resident(offset, s))
+		return bypass(offset, s) ? ent.data(buf, true, offset, s) : EAGAIN;
+	const filesize first = offset / pgsiz;
+	const filesize last = (offset + s - 1) / pgsiz;
+	pages_t::const_iterator it = pages.find(first);
+	for(filesize i = first; i <= last; i++, it++)
+		if(it == pages.end() || it->first != i)
+			return EAGAIN;
+	it = pages.find(first);
+	for(filesize i = first; i <= last; i++, it++) {
+		buffer& p = *it->second;
+		filesize b = max<filesize>(offset, p.offset);
+		filesize e = min<filesize>(offset + s, p.offset + pgsiz);
+		memcpy(buf + b - offset, &p[b - p.offset], e - b);
+		p.stamp = ++tick;
+	}
+	return 0;
+}
+int							pagecache::	fetch(filesize offset, filesize s) {
+	return load(offset / pgsiz, (offset + s - 1) / pgsiz);
+}
+int							pagecache::	expose(filesize offset, filesize s, bool r) {
+	// the device extents are about to be read or written without the cache
+	pages_t::iterator b = pages.lower_bound(offset / pgsiz);
+	pages_t::iterator e = pages.upper_bound((offset + s - 1) / pgsiz);
+	if(int res = store(b, e))
+		return res;
+	if(!r) {
+		fatx_context::get()->writeback.drain(&ent);
+		while(b != e)
+			release(b++);
+	}
+	return 0;
+}
+int							pagecache::	write(const char* buf, filesize offset, filesize s, filesize o) {
+	seen = fatx_context::get()->pool.tick();
+	if(bypass(offset, s))
+		return direct(const_cast<char*>(buf), false, offset, s);
+	const filesize first = offset / pgsiz;
+	const filesize last = (offset + s - 1) / pgsiz;
+	for(filesize i = first; i <= last; i++) {
+		buffer* p = get(i);
+		if(p == nullptr) {
+			// no memory left in the pool for this file
+			if((p = make(i, first, last)) == nullptr)
+				return direct(const_cast<char*>(buf), false, offset, s);
+			// previous content is only needed where the write does not cover the page
+			filesize ps = p->offset;
+			filesize pe = ps + pgsiz;
+			filesize n = 0;
+			if(ps < o && (ps < offset || (offset + s < pe && offset + s < o))) {
+				n = min<filesize>(pgsiz, o - ps);
+				if(int res = ent.data(&(*p)[0], true, ps, n)) {
+					release(pages.find(i));
+					return res;
+				}
+			}
+			memset(&(*p)[n], 0, pgsiz - n);
+		}
+		filesize b = max<filesize>(offset, p->offset);
+		filesize e = min<filesize>(offset + s, p->offset + pgsiz);
+		memcpy(&(*p)[b - p->offset], buf + b - offset, e - b);
+		mark(*p, true);
+		p->gen++;
+		#if defined DEBUG && defined DBGBUFDMP
+			(*p)(b - p->offset);
+		#endif
+		// a full page will not change soon, it is written behind
+		if(e == p->offset + pgsiz)
+			fatx_context::get()->writeback.push(&ent, i);
+	}
+	return 0;
+}
+int							pagecache::	flush() {
+	if(int res = store(pages.begin(), pages.end()))
+		return res;
+	if(behind) {
+		ent.touch(false, false, true);
+		if(int res = ent.save())
+			return res;
+		behind = false;
+	}
+	return 0;
+}
+bool						pagecache::	snapshot(const filesize& i, string& b, uint64_t& g) {
+	pages_t::iterator it = pages.find(i);
+	if(it == pages.end() || !it->second->touched || it->second->offset >= ent.size)
+		return false;
+	b.assign(&(*it->second)[0], min<filesize>(pgsiz, ent.size - it->second->offset));
+	g = it->second->gen;
+	return true;
+}
+void						pagecache::	clean(const filesize& i, const uint64_t& g) {
+	// page written again meanwhile stays dirty
+	pages_t::iterator it = pages.find(i);
+	if(it != pages.end() && it->second->gen == g) {
+		mark(*it->second, false);
+		behind = true;
+	}
+}
+void						pagecache::	cut(const filesize& s) {
+	pages_t::iterator b = pages.lower_bound((s + pgsiz - 1) / pgsiz);
+	while(b != pages.end())
+		release(b++);
+	// keep the tail of the last page clean for a later extension
+	if(!pages.empty() && pages.rbegin()->second->offset + pgsiz > s) {
+		buffer& p = *pages.rbegin()->second;
+		memset(&p[s - p.offset], 0, p.offset + pgsiz - s);
+	}
+}
+bool						pagecache::	dirty() const {
+	if(behind)
+		return true;
+	for(const pages_t::value_type& p: pages)
+		if(p.second->touched)
+			return true;
+	return false;
+}
+
 							// root entry constructor
 							entry::			entry() :
 	cptacc(0),
 	writeopened(none),
 	authb("B:/"),
 	authw("W:/"),
+	ready(false),
+	slotted(false),
+	eod(0),
+	seq(0),
+	seqs(0),
 	status(valid),
 	namesize(0),
 	cluster(fatx_context::get()->par.root_clus),
 	size(0),
 	loc(0),
 	parent(this),
-	entbuf(),
-	areas() {
+	pages(),
+	areas(),
+	jumps(make_shared<chainidx>()) {
 	memset	(name, '\0', name_size + 1);
 	flags.dir = true;
 	touch();
-	opendir();
+	if(lazy())
+		opendir();
+	else
+		scan();
 	entry* idx = find(fidx);
 	if(idx !=  nullptr) {
 		creation	= idx->creation;
@@ -2321,6 +3022,11 @@ void						memmap::		printfat() {
 	writeopened(none),
 	authb(),
 	authw(),
+	ready(false),
+	slotted(false),
+	eod(0),
+	seq(0),
+	seqs(0),
 	namesize(buf != 0 ? buf[0] : 0),
 	flags(buf != 0 ? buf[1] : '\0'),
 	cluster(buf != 0 ? endian<4>::litend(&buf[0x2C])() : 0),
@@ -2330,8 +3036,9 @@ void						memmap::		printfat() {
 	update((const unsigned char*)(buf != 0 ? &buf[0x3C] : "\0\0\0\0")),
 	loc(s),
 	parent(),
-	entbuf(),
-	areas() {
+	pages(),
+	areas(),
+	jumps(make_shared<chainidx>()) {
 	status = (
 		// 0xFF or 0x00 on 2 firsts bytes = end of entries
 		(buf == 0 || (buf[0] == EOD && buf[1] == EOD) || (buf[0] == 0 && buf[1] == 0)) ? end : (
@@ -2378,12 +3085,18 @@ void						memmap::		printfat() {
 	writeopened(none),
 	authb(),
 	authw(),
+	ready(true),
+	slotted(false),
+	eod(0),
+	seq(0),
+	seqs(0),
 	status(invalid),
 	namesize(0),
 	size(d ? 0 : s),
 	loc(0),
 	parent(),
-	entbuf() {
+	pages(),
+	jumps(make_shared<chainidx>()) {
 	areas = make_shared<vareas>(fatx_context::get()->fat->alloc(d ? 1 : clsarithm::siz2cls(s)));
 	cluster = ((!d && s == 0) || areas == 0) ? FLK : areas->first();
 	if(cluster == 0)
@@ -2399,11 +3112,15 @@ void						memmap::		printfat() {
 		entry(clsarithm::cls2ptr(cluster)).write();
 }
 							entry::			~entry() {
+	fatx_context::get()->prefetch.cancel(this);
+	fatx_context::get()->writeback.wait(this);
 	flush(false);
-	entbuf.reset();
+	pages.reset();
+	names.clear();
 	childs.clear();
 	parent = nullptr;
 	areas.reset();
+	jumps.reset();
 }
 
 #ifdef DEBUG
@@ -2429,24 +3146,165 @@ string						entry::			path() const {
 		((parent != nullptr) ? parent->path() : (string("?") + sepdir)) + name + (flags.dir ? sepdir : "")
 	));
 }
-void						entry::			opendir() {
-	if(status == end || status == invalid || !flags.dir || cluster == FLK || cluster == EOC)
+bool						entry::			lazy() {
+	// only a full scan finds lost chains and checks the whole tree
+	const frontend& mmi = fatx_context::get()->mmi;
+	return (mmi.prog == frontend::fuse && !mmi.recover) || mmi.prog == frontend::label;
+}
+void						entry::			load() {
+	if(!flags.dir || ready)
 		return;
-	bool marked		= false;
-	bool bad		= false;
-	for(clusptr clus_curr = cluster; clus_curr != EOC && clus_curr != FLK && !(marked && !fatx_context::get()->mmi.recover); clus_curr = fatx_context::get()->fat->read(clus_curr)) {
-		string buf = fatx_context::get()->dev.read(clsarithm::cls2ptr(clus_curr), fatx_context::get()->par.clus_size);
-		for(size_t i = 0; i < fatx_context::get()->par.clus_size && !(marked && !fatx_context::get()->mmi.recover); i += ent_size) {
-			std::auto_ptr<entry> ent(new entry(clsarithm::cls2ptr(clus_curr) + i, &buf[i]));
-			ent->parent = this;
-			ent->authw.name("W:" + ent->path());
-			ent->authb.name("B:" + ent->path());
-			if(ent->status == end)
-				marked = true;
-			if(ent->status == invalid && !marked)
-				bad = true;
-			if(ent->status == end || ent->status == invalid)
-				continue;
+	#ifndef NO_LOCK
+		scoped_lock<mutex> lock(authw);
+	#endif
+	if(!ready)
+		opendir();
+}
+size_t						entry::			entries() const {
+	// childs of a directory another thread may be reading or changing
+	if(!flags.dir)
+		return 0;
+	#ifndef NO_LOCK
+		sharable_lock<mutex> lock(authw);
+	#endif
+	return childs.size();
+}
+#if !defined NO_LOCK && !defined NO_PIO && !defined NO_FD
+struct						dirreads {
+	vector<dirdata_t::iterator>	todo;
+	std::atomic<size_t>			next;
+};
+static void*				readclus		(void* p) {
+	// clusters are taken one by one, a failed read is done again by the scan
+	dirreads& r = *(dirreads*)p;
+	const size_t s = fatx_context::get()->par.clus_size;
+	for(size_t i = r.next++; i < r.todo.size(); i = r.next++) {
+		string& b = r.todo[i]->second;
+		b.resize(s);
+		if(fatx_context::get()->dev.read(clsarithm::cls2ptr(r.todo[i]->first), &b[0], s))
+			b.clear();
+	}
+	return nullptr;
+}
+#endif
+static bool					dirend			(const string& b) {
+	// the end mark, or the empty entry some directories end with
+	for(size_t i = 0; i + 1 < b.size(); i += entry::ent_size)
+		if((b[i] == EOD && b[i + 1] == EOD) || (b[i] == 0 && b[i + 1] == 0))
+			return true;
+	return false;
+}
+void						entry::			scan() {
+	// level by level, the directory clusters of a batch are read by several threads,
+	// then the directories are opened in tree order by this one
+	vector<entry*> level(1, this);
+	while(!level.empty()) {
+		vector<entry*> next;
+		for(size_t b = 0, e = 0; b < level.size(); b = e) {
+			dirdata_t pre;
+			vector<clusptr> tails;
+			for(; e < level.size() && pre.size() < scan_batch; e++) {
+				const entry& d = *level[e];
+				if(d.status == end || d.status == invalid || !d.flags.dir || d.cluster == EOC || d.cluster == FLK || pre.count(d.cluster) != 0)
+					continue;
+				pre[d.cluster];
+				tails.push_back(d.cluster);
+			}
+			// first clusters of the directories, then the next one of those with no end mark yet
+			while(!tails.empty()) {
+				#if !defined NO_LOCK && !defined NO_PIO && !defined NO_FD
+					dirreads r;
+					r.next = 0;
+					for(clusptr c: tails)
+						r.todo.push_back(pre.find(c));
+					vector<pthread_t> workers;
+					for(size_t i = 1; i < min<size_t>(scan_threads, r.todo.size()); i++) {
+						pthread_t t;
+						if(pthread_create(&t, nullptr, readclus, &r) == 0)
+							workers.push_back(t);
+					}
+					readclus(&r);
+					for(pthread_t t: workers)
+						pthread_join(t, nullptr);
+				#endif
+				vector<clusptr> more;
+				for(clusptr c: tails) {
+					// a cluster not read is read again by opendir, with the rest of its directory
+					if(pre[c].empty() || dirend(pre[c]))
+						continue;
+					const clusptr n = fatx_context::get()->fat->read(c);
+					if(n != EOC && n != FLK && pre.count(n) == 0) {
+						pre[n];
+						more.push_back(n);
+					}
+				}
+				tails.swap(more);
+			}
+			for(size_t i = b; i < e; i++) {
+				level[i]->opendir(&pre);
+				for(entry& c: level[i]->childs)
+					if(c.flags.dir && c.status != delnodata)
+						next.push_back(&c);
+			}
+		}
+		level.swap(next);
+	}
+}
+void						entry::			opendir(dirdata_t* pre) {
+	// ready is set last, it is tested without the lock
+	if(status == end || status == invalid || !flags.dir || cluster == FLK || cluster == EOC) {
+		ready = true;
+		return;
+	}
+	snapshot::dirents_t saved;
+	if(fatx_context::get()->snap.take(cluster, saved)) {
+		// same chain and same clusters as at last unmount
+		for(const pair<streamptr, const char*>& i: saved) {
+			std::unique_ptr<entry> ent(new entry(i.first, i.second));
+			if(ent->status != valid)
+				continue;
+			ent->parent = this;
+			ent->authw.name("W:" + ent->path());
+			ent->authb.name("B:" + ent->path());
+			adopt(ent.release());
+		}
+		#ifdef DEBUG
+			dbglog((format("--> snapshot of %s: %d entries\n") % path() % childs.size()).str())
+		#endif
+		ready = true;
+		return;
+	}
+	bool marked		= false;
+	bool bad		= false;
+	streamptr send	= 0;
+	bool zero		= false;
+	set<streamptr> sdel;
+	for(clusptr clus_curr = cluster; clus_curr != EOC && clus_curr != FLK && !(marked && !fatx_context::get()->mmi.recover); clus_curr = fatx_context::get()->fat->read(clus_curr)) {
+		string buf;
+		if(pre != nullptr && pre->count(clus_curr) != 0)
+			buf.swap((*pre)[clus_curr]);
+		if(buf.empty())
+			buf = fatx_context::get()->dclus.read(clus_curr);
+		for(size_t i = 0; i < fatx_context::get()->par.clus_size && !(marked && !fatx_context::get()->mmi.recover); i += ent_size) {
+			if(send == 0) {
+				// free slots are found as addtodir looks for them
+				if(buf[i] == EOD && buf[i + 1] == EOD)
+					send = clsarithm::cls2ptr(clus_curr) + i;
+				else if((unsigned char)buf[i] == deleted_size)
+					sdel.insert(clsarithm::cls2ptr(clus_curr) + i);
+				else if(buf[i] == 0 && buf[i + 1] == 0)
+					zero = true;
+			}
+			std::auto_ptr<entry> ent(new entry(clsarithm::cls2ptr(clus_curr) + i, &buf[i]));
+			ent->parent = this;
+			ent->authw.name("W:" + ent->path());
+			ent->authb.name("B:" + ent->path());
+			if(ent->status == end)
+				marked = true;
+			if(ent->status == invalid && !marked)
+				bad = true;
+			if(ent->status == end || ent->status == invalid)
+				continue;
 			if(marked && ent->status == valid)
 				ent->status = delwdata;
 			if(!fatx_context::get()->mmi.recover && ent->status != valid)
@@ -2455,7 +3313,9 @@ void						entry::			opendir() {
 				dbglog(ent->print())
 			#endif
 			if(ent->status == valid) {
-				for(const entry& e: childs) {
+				auto same = names.equal_range(hashname(ent->name, strlen(ent->name)));
+				for(auto it = same.first; it != same.second; it++) {
+					const entry& e = *it->second;
 					if(e.status == valid && strncmp(ent->name, e.name, name_size) == 0) {
 						// duplicate reference case
 						console::write((format("Duplicate reference in same directory %s for entry %s.") % path() % ent->name).str(), fatx_context::get()->mmi.dialog);
@@ -2528,16 +3388,17 @@ void						entry::			opendir() {
 				if(ent.get() == nullptr)
 					continue;
 			}
-			childs.push_back(ent);
-			ent.reset();
-			if(childs.back().flags.dir && childs.back().status != delnodata) {
-				// go one step deep
-				childs.back().opendir();
-			}
+			adopt(ent.release());
 		}
 		if(!marked && fatx_context::get()->fat->read(clus_curr) == EOC)
 			marked = true;
 	}
+	// a directory closed by an empty entry stops being read before its end mark
+	if(send != 0 || !zero) {
+		slotted	= true;
+		eod		= send;
+		holes.swap(sdel);
+	}
 	if(status == valid && !marked) {
 		console::write((format("No end mark for directory \"%s\".") % name).str(), fatx_context::get()->mmi.dialog);
 		if(fatx_context::get()->mmi.prog == frontend::fsck) {
@@ -2550,9 +3411,10 @@ void						entry::			opendir() {
 	}
 	if(childs.empty() && bad)
 		status = delnodata;
+	ready = true;
 }
 void						entry::			closedir() {
-	if(!flags.dir)
+	if(!flags.dir || (slotted && eod != 0))
 		return;
 	set<const entry*> checked;
 	bool closed = false;
@@ -2562,7 +3424,7 @@ void						entry::			closedir() {
 		!closed && i != EOC && i != FLK;
 		i = fatx_context::get()->fat->read(i)
 	) {
-		string buf = fatx_context::get()->dev.read(clsarithm::cls2ptr(i), fatx_context::get()->par.clus_size);
+		string buf = fatx_context::get()->dclus.read(i);
 		for(
 			j = 0;
 			j < fatx_context::get()->par.clus_size;
@@ -2587,51 +3449,67 @@ void						entry::			closedir() {
 		}
 	}
 }
+void						entry::			findslots() {
+	// caller holds the lock of the directory
+	eod = 0;
+	holes.clear();
+	for(clusptr i = cluster; eod == 0 && i != EOC && i != FLK; i = fatx_context::get()->fat->read(i)) {
+		string buf = fatx_context::get()->dclus.read(i);
+		for(size_t j = 0; j < fatx_context::get()->par.clus_size; j += ent_size) {
+			if(buf[j] == EOD && buf[j + 1] == EOD) {
+				eod = clsarithm::cls2ptr(i) + j;
+				break;
+			}
+			if((unsigned char)buf[j] == deleted_size)
+				holes.insert(clsarithm::cls2ptr(i) + j);
+		}
+	}
+	slotted = true;
+}
 int							entry::			addtodir(entry* e) {
 	if(e == nullptr || !flags.dir || cluster == 0 || (e->flags.dir && e->cluster == 0))
 		return EFAULT;
+	load();
 	#ifndef NO_LOCK
 		authw.lock();
 	#endif
-	for(const entry& i: childs) {
-		if(i.namesize == e->namesize && strncmp(i.name, e->name, i.namesize) == 0) {
+	auto same = names.equal_range(hashname(e->name, strlen(e->name)));
+	for(auto it = same.first; it != same.second; it++) {
+		const entry& i = *it->second;
+		if(i.namesize == e->namesize && strncasecmp(i.name, e->name, i.namesize) == 0) {
 			#ifndef NO_LOCK
 				authw.unlock();
 			#endif
 			return EEXIST;
 		}
 	}
-	streamptr end = 0;
-	streamptr del = 0;
-	for(clusptr i = cluster; end == 0 && i != EOC && i != FLK; i = fatx_context::get()->fat->read(i)) {
-		string buf = fatx_context::get()->dev.read(clsarithm::cls2ptr(i), fatx_context::get()->par.clus_size);
-		for(size_t j = 0; j < fatx_context::get()->par.clus_size; j += ent_size) {
-			if(buf[j] == EOD && buf[j + 1] == EOD) {
-				end = clsarithm::cls2ptr(i) + j;
-				break;
-			}
-			if((unsigned char)buf[j] == deleted_size)
-				del = clsarithm::cls2ptr(i) + j;
-		}
-	}
-	if(end != 0) {
+	if(!slotted)
+		findslots();
+	if(eod != 0) {
 		// we have enough space in directory to add one more entry
-		e->loc		= end;
+		e->loc		= eod;
 		e->status	= entry::valid;
+		eod			= 0;
 		if(
-			(((end + ent_size - fatx_context::get()->par.root_start) >> fatx_context::get()->par.clus_pow) << fatx_context::get()->par.clus_pow) !=
-			(end + ent_size - fatx_context::get()->par.root_start)
+			(((e->loc + ent_size - fatx_context::get()->par.root_start) >> fatx_context::get()->par.clus_pow) << fatx_context::get()->par.clus_pow) !=
+			(e->loc + ent_size - fatx_context::get()->par.root_start)
 		) {
 			// we must mark the end of entries
-			entry(e->loc + ent_size).write();
+			eod = e->loc + ent_size;
+			entry(eod).write();
+		}
+		else if(fatx_context::get()->fat->read(clsarithm::ptr2cls(e->loc)) != EOC) {
+			// the end mark may be in the next cluster
+			slotted = false;
 		}
 	}
 	else {
 		// we search a deleted entry
-		if(del != 0) {
+		if(!holes.empty()) {
 			// we found one, and use it
-			e->loc		= del;
+			e->loc		= *holes.rbegin();
 			e->status	= entry::valid;
+			holes.erase(e->loc);
 		}
 		else {
 			// we have to allocate one cluster more in the directory
@@ -2653,75 +3531,144 @@ int							entry::			addtodir(entry* e) {
 			e->loc		= clsarithm::cls2ptr(areas->last());
 			e->status	= entry::valid;
 			// we must mark the end of entries
-			entry(e->loc + ent_size).write();
+			eod = e->loc + ent_size;
+			entry(eod).write();
 		}
 	}
 	e->parent = this;
-	childs.push_back(e);
+	adopt(e);
 	e->write();
 	#ifndef NO_LOCK
 		authw.unlock();
 	#endif
+	fatx_context::get()->dcache.forget(e);
 	touch(false, false, true);
 	return save();
 }
 void						entry::			remfrdir(entry* e, bool c) {
 	if(e->status != valid || e->flags.lab)
 		return;
+	fatx_context::get()->dcache.forget(e);
+	fatx_context::get()->notify.name(this, e);
 	if(c) {
+		e->load();
 		for(entry& f: e->childs)
 			e->remfrdir(&f);
 	}
+	#ifndef NO_LOCK
+		// write behind checks the status under the buffer lock, it cannot start once the clusters are freed
+		e->authb.lock();
+	#endif
+	fatx_context::get()->writeback.cancel(e);
 	#ifndef NO_LOCK
 		authw.lock();
 	#endif
-	if(e->cluster != 0)
-		fatx_context::get()->fat->free(e->cluster);
 	e->status = delnodata;
 	e->write();
-	if(c)
+	if(e->cluster != 0) {
+		// the deleted entry reaches the device before its clusters are freed, a crash must not leave it pointing to them
+		fatx_context::get()->dclus.sync(clsarithm::ptr2cls(e->loc));
+		// clusters of a removed directory are written before they can be reused
+		if(e->flags.dir)
+			for(clusptr i = e->cluster; i != EOC && i != FLK; i = fatx_context::get()->fat->read(i))
+				fatx_context::get()->dclus.release(i);
+		fatx_context::get()->fat->free(e->cluster);
+	}
+	#ifndef NO_LOCK
+		e->authb.unlock();
+	#endif
+	if(slotted)
+		holes.insert(e->loc);
+	if(c) {
+		index(e, false);
 		childs.release(find_if(childs.begin(), childs.end(), [e] (const entry& a) -> bool { return a == *e; })).release();
+	}
 	#ifndef NO_LOCK
 		authw.unlock();
 	#endif
+	// a walk that found the entry before its status changed may have cached it
+	fatx_context::get()->dcache.forget(e);
 	touch(false, false, true);
 	save();
 	return;
 }
-entry*						entry::			find(const char* path) {
-	entry*									res = this;
-	char_separator<char>					sep(sepdir);
-	string									src(path);
-	if(src.rfind(sepdir, src.size()) != string::npos && src.rfind(sepdir, src.size()) == (src.size() - 1))
-		src.erase(src.size() - 1);
-	tokenizer<char_separator<char> >		dirs(src, sep);
-	bool									found = true;
-	for(string d: dirs) {
-		#ifndef NO_LOCK
-			sharable_lock<mutex> lock(res->authw);
-		#endif
-		found = false;
-		for(entry& e: res->childs) {
-			if(e.status == entry::valid && ((fatx_context::get()->mmi.cutname) ? e.name == d.substr(0, name_size) : e.name == d)) {
-				found = true;
-				res	= &e;
-				break;
-			}
+size_t						entry::			hashname(const char* n, size_t l) {
+	// FNV-1a of the name, case folded as FATX names are case insensitive
+	uint64_t h = 14695981039346656037ULL;
+	for(size_t i = 0; i < l && n[i] != '\0'; i++)
+		h = (h ^ (unsigned char)tolower((unsigned char)n[i])) * 1099511628211ULL;
+	return (size_t)h;
+}
+void						entry::			index(entry* e, bool a) {
+	// caller holds the lock of the directory
+	size_t h = hashname(e->name, strlen(e->name));
+	if(a) {
+		names.insert(make_pair(h, e));
+		return;
+	}
+	auto same = names.equal_range(h);
+	for(auto it = same.first; it != same.second; it++) {
+		if(it->second == e) {
+			names.erase(it);
+			return;
 		}
-		if(!found && fatx_context::get()->mmi.recover) {
-			for(entry& e: res->childs) {
-				if(e.name == d.substr(0, name_size)) {
-					found = true;
-					res	= &e;
-					break;
-				}
-			}
+	}
+}
+entry*						entry::			child(const char* n, size_t l) {
+	// exact name first, then the same name in another case
+	entry* res = nullptr;
+	const size_t t = min<size_t>(l, name_size);
+	const size_t k = fatx_context::get()->mmi.cutname ? t : l;
+	auto same = names.equal_range(hashname(n, t));
+	if(k <= name_size) {
+		for(auto it = same.first; it != same.second; it++) {
+			entry& e = *it->second;
+			if(e.status != entry::valid || strlen(e.name) != k)
+				continue;
+			if(strncmp(e.name, n, k) == 0)
+				return &e;
+			if(res == nullptr && strncasecmp(e.name, n, k) == 0)
+				res = &e;
 		}
-		if(!found)
-			break;
 	}
-	if(!found)
-		res = nullptr;
+	if(res == nullptr && fatx_context::get()->mmi.recover) {
+		for(auto it = same.first; it != same.second; it++) {
+			entry& e = *it->second;
+			if(strlen(e.name) == t && strncmp(e.name, n, t) == 0)
+				return &e;
+		}
+	}
+	return res;
+}
+void						entry::			adopt(entry* e) {
+	// caller holds the lock of the directory, ranks grow along childs
+	e->seq = ++seqs;
+	childs.push_back(e);
+	index(e, true);
+}
+void						entry::			list(size_t from, const function<bool(const entry&, size_t)>& f) {
+	// childs from rank from, while f asks for more: a removed entry does not move the others
+	load();
+	#ifndef NO_LOCK
+		sharable_lock<mutex> lock(authw);
+	#endif
+	ptr_vector<entry>::const_iterator i = lower_bound(childs.begin(), childs.end(), from, [] (const entry& a, size_t r) -> bool { return a.seq < r; });
+	for(; i != childs.end() && f(*i, i->seq); i++);
+}
+entry*						entry::			find(const char* path) {
+	// components are compared in place, without copying them
+	entry* res = this;
+	for(const char* p = path; res != nullptr && *p != '\0'; ) {
+		size_t l = strcspn(p, sepdir);
+		if(l != 0) {
+			res->load();
+			#ifndef NO_LOCK
+				sharable_lock<mutex> lock(res->authw);
+			#endif
+			res = res->child(p, l);
+		}
+		p += l + (p[l] != '\0');
+	}
 	return res;
 }
 void						entry::			touch(bool cre, bool acc, bool upd) {
@@ -2739,16 +3686,12 @@ void						entry::			touch(bool cre, bool acc, bool upd) {
 		(void) upd;
 	#endif
 }
-int							entry::			write() {
-	if(status == invalid || (flags.dir && cluster == 0))
-		return EFAULT;
-	if(loc == 0)
-		return 0;
+string						entry::			record() const {
+	// raw content of the entry in its directory
 	string buf(ent_size, '\0');
 	if(status == end)
 		memset(&buf[0], EOD, ent_size);
 	else {
-		touch(false, true, false);
 		buf[0] = (status == delwdata || status == delnodata) ? deleted_size : strlen(name);
 		flags.write(&buf[1]);
 		memcpy(&buf[2], name, name_size);
@@ -2758,7 +3701,19 @@ int							entry::			write() {
 		access.write((unsigned char*)&buf[0x38]);
 		update.write((unsigned char*)&buf[0x3C]);
 	}
-	return fatx_context::get()->dev.write(loc, buf);
+	return buf;
+}
+int							entry::			write() {
+	if(status == invalid || (flags.dir && cluster == 0))
+		return EFAULT;
+	if(loc == 0)
+		return 0;
+	if(status != end)
+		touch(false, true, false);
+	int res = fatx_context::get()->dclus.write(loc, record());
+	if(res == 0)
+		fatx_context::get()->notify.attr(this);
+	return res;
 }
 int							entry::			save() {
 	if(parent == this)
@@ -2779,6 +3734,8 @@ int							entry::			rename(const char* n) {
 	string nstr = string(n);
 	if(nstr.empty() || flags.lab)
 		return 0;
+	fatx_context::get()->dcache.forget(this);
+	fatx_context::get()->notify.name(parent, this);
 	if(nstr.rfind(sepdir, nstr.size()) != string::npos) {
 		assert(parent != nullptr);
 		entry* newpar = fatx_context::get()->root->find(&nstr.substr(0, nstr.rfind(sepdir, nstr.size()))[0]);
@@ -2792,6 +3749,9 @@ int							entry::			rename(const char* n) {
 			status = delwdata;
 			write();
 			status = valid;
+			if(oldpar->slotted)
+				oldpar->holes.insert(loc);
+			oldpar->index(this, false);
 			ptr_vector<entry>::auto_type me = oldpar->childs.release(find_if(oldpar->childs.begin(), oldpar->childs.end(), [this] (const entry& a) -> bool { return &a == this; }));
 			#ifndef NO_LOCK
 				oldpar->authw.unlock();
@@ -2810,9 +3770,19 @@ int							entry::			rename(const char* n) {
 	}
 	if(!fatx_context::get()->mmi.cutname && nstr.size() > name_size)
 		return -ENAMETOOLONG;
+	assert(parent != nullptr);
+	#ifndef NO_LOCK
+		parent->authw.lock();
+	#endif
+	parent->index(this, false);
 	memset		(name, '\0', name_size + 1);
 	strncpy		(name, &nstr[0], (nstr.size() <= name_size) ? nstr.size() : name_size);
 	namesize	= (status == valid) ? ((nstr.size() <= name_size) ? nstr.size() : name_size) : namesize;
+	parent->index(this, true);
+	#ifndef NO_LOCK
+		parent->authw.unlock();
+	#endif
+	fatx_context::get()->dcache.forget(this);
 	return save();
 }
 void						entry::			recover() {
@@ -2827,10 +3797,15 @@ void						entry::			recover() {
 			}
 			else {
 				ofstream f(name, ios::binary | ios::trunc);
-				string s(size, '\0');
-				data(&s[0], true, 0, size);
-				f << s;
+				int res = streamer::copy(size, [this] (char* b, filesize o, size_t c) -> int {
+					return data(b, true, o, c);
+				}, [&f] (char* b, filesize, size_t c) -> int {
+					f.write(b, c);
+					return f ? 0 : EIO;
+				});
 				f.close();
+				if(res)
+					console::write((format("Can't write file %s locally.\n") % name).str(), true);
 			}
 		}
 		else
@@ -2844,7 +3819,7 @@ void						entry::			recover() {
 			console::write("Can't restore file. Another valid file with same name exists in this directory.\n", true);
 		}
 		else {
-			string buf = fatx_context::get()->dev.read(clsarithm::cls2ptr(clsarithm::ptr2cls(loc)), fatx_context::get()->par.clus_size);
+			string buf = fatx_context::get()->dclus.read(clsarithm::ptr2cls(loc));
 			streamptr mark = 0;
 			for(size_t i = 0; i < buf.size(); i+= ent_size) {
 				if(buf[i] == EOD) {
@@ -2858,10 +3833,12 @@ void						entry::			recover() {
 				none.status = delwdata;
 				none.write();
 				for(size_t i = mark + ent_size; i < clsarithm::cls2ptr(clsarithm::ptr2cls(loc)) + fatx_context::get()->par.clus_size; i+= ent_size)
-					fatx_context::get()->dev.write(i, string(1, deleted_size));
+					fatx_context::get()->dclus.write(i, string(1, deleted_size));
 			}
 			status = entry::valid;
 			write();
+			// the end mark moved, free slots are found again at next insertion
+			parent->slotted = false;
 			fatx_context::get()->fat->getareas(cluster, [this] (const clusptr& c, const clusptr& v) -> void {
 				fatx_context::get()->fat->write(c, v);
 				dynamic_cast<memmap*>(fatx_context::get()->fat)->memchain.find(c)->second.status = memmap::modified;
@@ -3038,6 +4015,13 @@ bool						entry::			analyse(const pass_t& step, const string header) {
 	}
 	return recovered;
 }
+int							entry::			truncate(const filesize s) {
+	// resize out of the file cache, a spliced read could still be sending the dropped clusters
+	#ifndef NO_LOCK
+		scoped_lock<mutex> lock(authb);
+	#endif
+	return resize(s);
+}
 int							entry::			resize(const filesize s) {
 	#ifdef DEBUG
 		dbglog((format("RESIZE: %s size:%d->%d\n") % path() % size % s).str())
@@ -3052,8 +4036,14 @@ int							entry::			resize(const filesize s) {
 	}
 	if(s == size)
 		return 0;
+	if(pages && s < size) {
+		// clusters may be freed, nothing must still be written in them
+		fatx_context::get()->writeback.cancel(this);
+		pages->cut(s);
+	}
 	if(s == 0) {
 		areas.reset();
+		jumps->clear();
 		fatx_context::get()->fat->free(cluster);
 		cluster = 0;
 		size = s;
@@ -3062,19 +4052,31 @@ int							entry::			resize(const filesize s) {
 		vareas v = fatx_context::get()->fat->alloc(clsarithm::siz2cls(s));
 		if(v.empty())
 			return ENOSPC;
+		jumps->clear();
 		cluster = v.first();
 		size = s;
 		areas = make_shared<vareas>(v.sub(size));
 	}
 	if(s != size) {
 		int res = 0;
+		if(!areas || areas->empty()) {
+			// the whole chain is only needed to change its length
+			areas = make_shared<vareas>(fatx_context::get()->fat->getareas(cluster).sub(size));
+			if(areas->empty())
+				return EFAULT;
+		}
 		if((res = fatx_context::get()->fat->resize(areas, clsarithm::siz2cls(s))))
 			return res;
+		jumps->cut(clsarithm::siz2cls(s));
 		size = s;
 		areas = make_shared<vareas>(areas->sub(size));
 	}
 	return save();
 }
+vareas						entry::			extents(filesize s, filesize offset) const {
+	// without a materialized chain, we only walk from the nearest checkpoint
+	return (areas && !areas->empty()) ? areas->sub(s, offset) : fatx_context::get()->fat->getareas(cluster, *jumps, s, offset);
+}
 int							entry::			data(char* buf, bool r, filesize offset, filesize s) {
 	s			= (s == 0) ? (r ? size - offset : size) : (r ? min<filesize>(s, size - offset) : s);
 	#ifdef DEBUG
@@ -3093,19 +4095,17 @@ int							entry::			data(char* buf, bool r, filesize offset, filesize s) {
 			return res;
 		}
 	}
-	if(size != 0) {
-		if(!areas || areas->empty()) {
-			areas.reset(new vareas(fatx_context::get()->fat->getareas(cluster).sub(size)));
-			if(areas->empty())
-				return EFAULT;
-		}
-		for(const area& i: areas->sub(s, offset)) {
+	if(size != 0 && s != 0) {
+		vareas va = extents(s, offset);
+		if(va.empty())
+			return EFAULT;
+		for(const area& i: va) {
 			if(r)
-				memcpy(buf + i.offset - offset, &fatx_context::get()->dev.read(i.pointer, i.size)[0], i.size);
-			else {
-				if((res = fatx_context::get()->dev.write(i.pointer, string(buf + i.offset - offset, i.size))))
-					return res;
-			}
+				res = fatx_context::get()->dev.read(i.pointer, buf + i.offset - offset, i.size);
+			else
+				res = fatx_context::get()->dev.write(i.pointer, buf + i.offset - offset, i.size);
+			if(res)
+				return res;
 		}
 	}
 	if(!r) {
@@ -3119,38 +4119,37 @@ size_t						entry::			bufread(char* buf, filesize offset, filesize s) {
 	if(s == 0)
 		return 0;
 	#ifndef NO_LOCK
-		scoped_lock<mutex> xlock(authb);
-	#endif
-	if(entbuf && (offset < entbuf->offset || (entbuf->offset + entbuf->size() - 1) < (offset + s - 1))) {
-		if(flush(false)) {
-			#ifdef DEBUG
-				dbglog((format("**> flush buffer failed (%s)") % path()).str())
-			#endif
-			return 0;
-		}
-		entbuf.reset();
-	}
-	if(!entbuf) {
-		entbuf.reset(new buffer(offset, size - offset));
-		if(entbuf->size() < s || data(&(*entbuf.get())[0], true, entbuf->offset, entbuf->size())) {
-			#ifdef DEBUG
-				dbglog((format("**> alloc buffer or read operation failed (%s: 0x%08X %d)") % path() % offset % s).str())
-			#endif
-			return 0;
+		{
+			// readers of resident data share the lock, a miss is served exclusively
+			sharable_lock<mutex> lock(authb);
+			if(pages) {
+				int res = pages->peek(buf, offset, s);
+				if(res == 0) {
+					#ifdef DEBUG
+						dbglog((format("--> read shared (%s at 0x%08X: %d)\n") % path() % offset % s).str())
+					#endif
+					return s;
+				}
+				if(res != EAGAIN) {
+					#ifdef DEBUG
+						dbglog((format("**> read operation failed (%s: 0x%08X %d)") % path() % offset % s).str())
+					#endif
+					return 0;
+				}
+			}
 		}
+		scoped_lock<mutex> lock(authb);
+	#endif
+	if(!pages)
+		pages.reset(new pagecache(*this, authb));
+	if(pages->read(buf, offset, s)) {
 		#ifdef DEBUG
-			dbglog((format("--> new read buffer (%s at 0x%08X: %d)\n") % path() %  entbuf.get() % entbuf->size()).str())
+			dbglog((format("**> read operation failed (%s: 0x%08X %d)") % path() % offset % s).str())
 		#endif
+		return 0;
 	}
-	#ifndef NO_LOCK
-		sharable_lock<mutex> slock(boost::move(xlock));
-	#endif
-	memcpy(buf, &(*entbuf)[offset - entbuf->offset], s);
 	#ifdef DEBUG
-		dbglog((format("--> read buffer (%s at 0x%08X(%d): %d(%d))\n") % path() %  entbuf.get() % entbuf->size() % (offset - entbuf->offset) % min<filesize>(s, entbuf->size())).str())
-	#endif
-	#if defined DEBUG && defined DBGBUFDMP
-		(*entbuf)(offset - entbuf->offset);
+		dbglog((format("--> read cache (%s at 0x%08X: %d)\n") % path() % offset % s).str())
 	#endif
 	return s;
 }
@@ -3161,54 +4160,145 @@ size_t						entry::			bufwrite(const char* buf, filesize offset, filesize s) {
 		#endif
 		return false;
 	}
+	if(s == 0)
+		return 0;
+	fatx_context::get()->writeback.throttle();
 	#ifndef NO_LOCK
 		scoped_lock<mutex> lock(authb);
 	#endif
+	filesize o = size;
 	if(size < offset + s && resize(offset + s)) {
 		#ifdef DEBUG
 			dbglog((format("**> file resize failed (%s: 0x%08X %d)") % path() % offset % s).str())
 		#endif
 		return 0;
 	}
-	int res = 0;
-	if(entbuf) {
-		if(entbuf->offset + entbuf->size() == offset) {
-			entbuf->enlarge(entbuf->size() + s);
-			if(entbuf->offset + entbuf->size() < offset + s) {
-				res = flush(false);
-				entbuf.reset();
-			}
-		}
-		else {
-			res = flush(false);
-			entbuf.reset();
-		}
-		if(res) {
-			#ifdef DEBUG
-				dbglog((format("**> flush buffer failed (%s)") % path()).str())
-			#endif
-			return 0;
-		}
-	}
-	if(!entbuf) {
-		entbuf.reset(new buffer(offset, s));
-		if(!entbuf || entbuf->size() < s) {
-			#ifdef DEBUG
-				dbglog((format("**> alloc buffer failed (%s: 0x%08X %d)") % path() % offset % s).str())
-			#endif
-			return 0;
-		}
+	if(!pages)
+		pages.reset(new pagecache(*this, authb));
+	if(pages->write(buf, offset, s, o)) {
+		#ifdef DEBUG
+			dbglog((format("**> write operation failed (%s: 0x%08X %d)") % path() % offset % s).str())
+		#endif
+		return 0;
 	}
-	memcpy(&(*entbuf)[offset - entbuf->offset], buf, s);
-	entbuf->touched = true;
 	#ifdef DEBUG
-		dbglog((format("--> write buffer (%s at 0x%08X(%d): %d(%d))\n") % path() %  entbuf.get() % entbuf->size() % (offset - entbuf->offset) % min<filesize>(s, entbuf->size())).str())
+		dbglog((format("--> write cache (%s at 0x%08X: %d)\n") % path() % offset % s).str())
 	#endif
-	#if defined DEBUG && defined DBGBUFDMP
-		(*entbuf)(offset - entbuf->offset);
+	return s;
+}
+ssize_t						entry::			copy(entry& src, filesize from, filesize offset, filesize s) {
+	// device extents of the source are copied to the extents of this file, without the file caches
+	if(!writeable())
+		return -EACCES;
+	if(flags.dir || src.flags.dir)
+		return -EISDIR;
+	if(&src == this)
+		return -EOPNOTSUPP;
+	vareas sv;
+	{
+		#ifndef NO_LOCK
+			scoped_lock<mutex> lock(src.authb);
+		#endif
+		s = (from < src.size) ? min<filesize>(s, src.size - from) : 0;
+		if(s == 0)
+			return 0;
+		if(src.pages)
+			if(int res = src.pages->expose(from, s, true))
+				return -res;
+		sv = src.extents(s, from);
+	}
+	if(sv.empty())
+		return -EFAULT;
+	#ifndef NO_LOCK
+		scoped_lock<mutex> lock(authb);
 	#endif
+	filesize o = size;
+	if(size < offset + s)
+		if(int res = resize(offset + s))
+			return -res;
+	if(pages)
+		if(int res = pages->expose(offset, s, false))
+			return -res;
+	// new clusters between the former end of file and the copy read as zeros
+	for(filesize z = o; z < offset;) {
+		const filesize n = min<filesize>(offset - z, fatx_context::get()->par.clus_size);
+		if(int res = data(&string(n, 0)[0], false, z, n))
+			return -res;
+		z += n;
+	}
+	vareas dv = extents(s, offset);
+	if(dv.empty())
+		return -EFAULT;
+	// both lists of extents cover s bytes, runs are cut where either one breaks
+	vareas::const_iterator a = sv.begin();
+	vareas::const_iterator b = dv.begin();
+	filesize ai = 0;
+	filesize bi = 0;
+	for(filesize done = 0; done < s && a != sv.end() && b != dv.end();) {
+		const filesize n = min<filesize>(min<filesize>(a->size - ai, b->size - bi), s - done);
+		if(int res = fatx_context::get()->dev.copy(a->pointer + ai, b->pointer + bi, n))
+			return -res;
+		done += n;
+		if((ai += n) == a->size) {
+			a++;
+			ai = 0;
+		}
+		if((bi += n) == b->size) {
+			b++;
+			bi = 0;
+		}
+	}
+	touch(false, false, true);
+	if(int res = save())
+		return -res;
 	return s;
 }
+void						entry::			prefetch(filesize offset, filesize s) {
+	// page by page, so that the reader of the file is not held up for the whole window
+	const size_t pgsiz = fatx_context::get()->pool.page();
+	for(filesize o = offset; o < offset + s; o += pgsiz - o % pgsiz) {
+		#ifndef NO_LOCK
+			scoped_lock<mutex> lock(authb);
+		#endif
+		if(cptacc == 0 || o >= size)
+			return;
+		if(!pages)
+			pages.reset(new pagecache(*this, authb));
+		if(pages->fetch(o, min<filesize>(min<filesize>(pgsiz - o % pgsiz, offset + s - o), size - o)))
+			return;
+	}
+}
+int							entry::			writebehind(filesize i) {
+	// page is copied under lock, and written to the device without it
+	string b;
+	uint64_t g = 0;
+	vareas va;
+	const filesize o = i * fatx_context::get()->pool.page();
+	{
+		#ifndef NO_LOCK
+			scoped_lock<mutex> lock(authb);
+		#endif
+		if(status != valid || !pages || !pages->snapshot(i, b, g))
+			return 0;
+		va = extents(b.size(), o);
+		if(va.empty())
+			return EFAULT;
+		fatx_context::get()->writeback.begin(this);
+	}
+	int res = 0;
+	for(const area& a: va)
+		if((res = fatx_context::get()->dev.write(a.pointer, &b[a.offset - o], a.size)))
+			break;
+	fatx_context::get()->writeback.end(this);
+	if(!res) {
+		#ifndef NO_LOCK
+			scoped_lock<mutex> lock(authb);
+		#endif
+		if(pages)
+			pages->clean(i, g);
+	}
+	return res;
+}
 int							entry::			flush(bool l) {
 	if(flags.dir)
 		return 0;
@@ -3219,22 +4309,15 @@ int							entry::			flush(bool l) {
 	#else
 		(void) l;
 	#endif
-	if(entbuf) {
+	if(pages) {
 		#ifdef DEBUG
-		if(entbuf->touched)
-			dbglog((format("<-> flush buffer (%s at 0x%08X: %d)\n") % path() % entbuf.get() % entbuf->size()).str())
+		if(pages->dirty())
+			dbglog((format("<-> flush cache (%s)\n") % path()).str())
 		else
-			dbglog((format("<-> no need to flush buffer (%s at 0x%08X: %d)\n") % path() % entbuf.get() % entbuf->size()).str())
+			dbglog((format("<-> no need to flush cache (%s)\n") % path()).str())
 		#endif
-		if(entbuf->touched) {
-			if(writeable()) {
-				res = data(&(*entbuf.get())[0], false, entbuf->offset, entbuf->size());
-				if(!res)
-					entbuf.reset();
-			}
-			else
-				res = EACCES;
-		}
+		if(pages->dirty())
+			res = writeable() ? pages->flush() : EACCES;
 	}
 	#ifndef NO_LOCK
 		if(l)
@@ -3253,8 +4336,7 @@ void						entry::			open(bool w) {
 		#endif
 		if(writeopened != yes)
 			writeopened = w ? yes : no;
-		if(cptacc++ == 0 && cluster != 0 && size != 0)
-			areas = make_shared<vareas>(fatx_context::get()->fat->getareas(cluster).sub(size));
+		cptacc++;
 	}
 }
 void						entry::			close(bool w) {
@@ -3266,17 +4348,18 @@ void						entry::			close(bool w) {
 				authw.unlock_sharable();
 		#endif
 		if(writeable()) {
+			fatx_context::get()->writeback.wait(this);
 			flush(true);
 			if(writeopened == yes)
 				writeopened = no;
 		}
 		if(--cptacc == 0) {
+			fatx_context::get()->prefetch.cancel(this);
 			areas.reset();
 			#ifndef NO_LOCK
 				authb.lock();
 			#endif
-			if(entbuf)
-				entbuf.reset();
+			pages.reset();
 			#ifndef NO_LOCK
 				authb.unlock();
 			#endif
@@ -3292,137 +4375,1715 @@ bool						entry::			operator == (const entry& b) const {
 		strncmp(name, b.name, namesize) == 0
 	;
 }
-#if !defined NO_FUSE && !defined NO_SPLICE
-struct fuse_bufvec*			entry::			getbufvec(filesize offset, filesize s) {
-	ptr_vareas va = fatx_context::get()->fat->getareas(cluster).sub(s, offset);
-	if(va->empty())
-		return 0;
-	struct fuse_bufvec *bufv2 = 0;
-	struct fuse_bufvec *bufv = (struct fuse_bufvec*)malloc(sizeof(struct fuse_bufvec));
+#if !defined NO_FUSE && !defined NO_SPLICE && !defined NO_FUSE_CALL
+static struct fuse_bufvec*	devbufvec		(const vareas& va) {
+	// one buffer per device extent
+	struct fuse_bufvec* bufv = (struct fuse_bufvec*)malloc(sizeof(struct fuse_bufvec) + va.size() * sizeof(struct fuse_buf));
 	if(!bufv)
 		return 0;
+	bufv->count	= 0;
 	bufv->idx	= 0;
-	bufv->off	= offset % fatx_context::get()->par.clus_size;
-	size_t count = 0;
-	for(const area& i: *va) {
-		if(count > 0) {
-			if(!(bufv2 = (struct fuse_bufvec*)realloc(bufv, sizeof(struct fuse_bufvec) + count * sizeof(struct fuse_buf)))) {
-				free(bufv);
-				return 0;
-			}
-			bufv = bufv2;
-		}
-		bufv->buf[count].size	= i.size;
-		bufv->buf[count].flags	= (fuse_buf_flags)(FUSE_BUF_IS_FD | FUSE_BUF_FD_SEEK);
-		bufv->buf[count].fd		= fileno(fatx_context::get()->dev.getfd());
-		bufv->buf[count].mem	= 0;
-		bufv->buf[count].pos	= i.pointer;
-		count++;
+	bufv->off	= 0;
+	for(const area& i: va) {
+		struct fuse_buf& b = bufv->buf[bufv->count++];
+		b.size	= i.size;
+		b.flags	= (fuse_buf_flags)(FUSE_BUF_IS_FD | FUSE_BUF_FD_SEEK | FUSE_BUF_FD_RETRY);
+		b.mem	= 0;
+		b.fd	= fileno(fatx_context::get()->dev.getfd());
+		b.pos	= i.pointer;
 	}
 	return bufv;
 }
-#endif
-
-#ifndef NO_FUSE
-static int					fatx_getattr	(const char* path, struct stat* st) {
-	#ifdef DEBUG
-		dbglog((format("GETATTR: %s\n") % path).str())
+int							entry::			bufreply(fuse_req_t req, filesize offset, filesize s) {
+	// reply part of the file as a vector of device extents, for the kernel to splice
+	// dirty pages are written under the exclusive lock, then a shared one is held until the kernel
+	// has read the extents, a truncate could give the clusters to another file
+	#ifndef NO_LOCK
+		scoped_lock<mutex> xlock(authb);
 	#endif
-	entry* f = fatx_context::get()->root->find(path);
-	if(f == nullptr || f->status == entry::invalid || (f->flags.dir && f->cluster == 0))
-		return -ENOENT;
-	memset(st, 0, sizeof(struct stat));
-	st->st_dev		= fatx_context::get()->par.par_id;
-	st->st_mode		= f->flags() & (fatx_context::get()->mmi.mask | S_IFDIR | S_IFREG);
-	st->st_nlink	= f->childs.size() + 1;
-	st->st_size		= f->flags.dir ? f->childs.size() : f->size;
-	st->st_blksize	= fatx_context::get()->par.clus_size;
-	st->st_blocks	= clsarithm::siz2cls(f->size) * fatx_context::get()->par.clus_size / blksize;
-	st->st_atime	= f->access();
-	st->st_mtime	= f->update();
-	st->st_ctime	= f->creation();
-	st->st_uid		= fatx_context::get()->mmi.uid;
-	st->st_gid		= fatx_context::get()->mmi.gid;
-	#ifdef DEBUG
-		dbglog(f->print())
+	s = (offset < size) ? min<filesize>(s, size - offset) : 0;
+	vareas va;
+	if(s != 0) {
+		if(pages && pages->expose(offset, s, true))
+			return fuse_reply_err(req, EIO);
+		if((va = extents(s, offset)).empty())
+			return fuse_reply_err(req, EIO);
+	}
+	#ifndef NO_LOCK
+		sharable_lock<mutex> lock(std::move(xlock));
 	#endif
+	struct fuse_bufvec* bufv = devbufvec(va);
+	if(!bufv)
+		return fuse_reply_err(req, ENOMEM);
+	int res = fuse_reply_data(req, bufv, FUSE_BUF_SPLICE_MOVE);
+	free(bufv);
+	return res;
+}
+ssize_t						entry::			bufsplice(struct fuse_bufvec* src, filesize offset) {
+	// write the buffers of the kernel straight to the device extents
+	filesize s = fuse_buf_size(src);
+	if(!writeable())
+		return -EACCES;
+	if(s == 0)
+		return 0;
+	#ifndef NO_LOCK
+		scoped_lock<mutex> lock(authb);
+	#endif
+	filesize o = size;
+	if(size < offset + s)
+		if(int res = resize(offset + s))
+			return -res;
+	if(pages)
+		if(int res = pages->expose(offset, s, false))
+			return -res;
+	// new clusters between the former end of file and the write read as zeros
+	for(filesize z = o; z < offset;) {
+		const filesize n = min<filesize>(offset - z, fatx_context::get()->par.clus_size);
+		if(int res = data(&string(n, 0)[0], false, z, n))
+			return -res;
+		z += n;
+	}
+	vareas va = extents(s, offset);
+	if(va.empty())
+		return -EFAULT;
+	struct fuse_bufvec* dst = devbufvec(va);
+	if(!dst)
+		return -ENOMEM;
+	ssize_t res = fuse_buf_copy(dst, src, (fuse_buf_copy_flags)0);
+	free(dst);
+	if(res > 0) {
+		touch(false, false, true);
+		if(int err = save())
+			return -err;
+	}
+	return res;
+}
+#endif
+
+							handle::		handle(entry& e) :
+	next(0),
+	ahead(0),
+	rate(0),
+	last(posix_time::microsec_clock::universal_time()),
+	access("handle"),
+	ent(e) {
+}
+size_t						handle::		read(char* buf, filesize offset, filesize s) {
+	size_t res = ent.bufread(buf, offset, s);
+	posix_time::ptime now = posix_time::microsec_clock::universal_time();
+	filesize from = 0;
+	filesize n = 0;
+	{
+		#ifndef NO_LOCK
+			scoped_lock<mutex> lock(access);
+		#endif
+		if(offset != next || res == 0) {
+			// random access: nothing to prefetch
+			ahead	= 0;
+			rate	= 0;
+		}
+		else {
+			// window sized on the consumption rate, within the share of the file in the pool
+			double d = (now - last).total_microseconds() / 1000000.0;
+			if(d > 0)
+				rate = (rate == 0) ? res / d : (3 * rate + res / d) / 4;
+			const size_t pgsiz = fatx_context::get()->pool.page();
+			filesize window = min<filesize>(
+				max<filesize>(rate * ra_span / 1000, 2 * pgsiz),
+				max<filesize>(fatx_context::get()->pool.share() / 2, pgsiz)
+			);
+			window = (window + pgsiz - 1) / pgsiz * pgsiz;
+			filesize end = offset + res;
+			ahead = max<filesize>(ahead, end);
+			if(ahead < ent.size && ahead - end < window / 2) {
+				from = ahead;
+				n = min<filesize>(end + window, ent.size) - ahead;
+				ahead += n;
+			}
+		}
+		next = offset + res;
+		last = now;
+	}
+	if(n != 0) {
+		#if defined DEBUG && defined DBG_BUFFER
+			dbglog((format("... read ahead: %s 0x%08X %d\n") % ent.path() % from % n).str())
+		#endif
+		fatx_context::get()->prefetch.push(&ent, from, n);
+	}
+	return res;
+}
+
+							streamer::		streamer(filesize s, const io_t& i) :
+	in(i),
+	total(s),
+	chunks((s + cp_chunk - 1) / cp_chunk),
+	reads(0),
+	writes(0),
+	res(0),
+	cancel(false) {
+	for(string& b: bufs)
+		b.resize(min<filesize>(s, cp_chunk));
+	#ifndef NO_LOCK
+		pthread_mutex_init(&access, nullptr);
+		pthread_cond_init(&wake, nullptr);
+	#endif
+}
+							streamer::		~streamer() {
+	#ifndef NO_LOCK
+		pthread_cond_destroy(&wake);
+		pthread_mutex_destroy(&access);
+	#endif
+}
+size_t						streamer::		size(size_t c) const {
+	return (size_t)min<filesize>(total - (filesize)c * cp_chunk, cp_chunk);
+}
+#ifndef NO_LOCK
+void*						streamer::		run(void* p) {
+	streamer& st = *(streamer*)p;
+	pthread_mutex_lock(&st.access);
+	for(size_t c = 0; c < st.chunks; c++) {
+		// a buffer is read again once its chunk is written
+		while(!st.cancel && c - st.writes == 2)
+			pthread_cond_wait(&st.wake, &st.access);
+		if(st.cancel)
+			break;
+		pthread_mutex_unlock(&st.access);
+		int r = st.in(&st.bufs[c & 1][0], (filesize)c * cp_chunk, st.size(c));
+		pthread_mutex_lock(&st.access);
+		if(r)
+			st.res = r;
+		else
+			st.reads++;
+		pthread_cond_signal(&st.wake);
+		if(r)
+			break;
+	}
+	pthread_mutex_unlock(&st.access);
+	return nullptr;
+}
+#endif
+int							streamer::		copy(filesize s, const io_t& in, const io_t& out) {
+	// at most two chunks in memory, whatever the size of the file
+	if(s == 0)
+		return 0;
+	streamer st(s, in);
+	int res = 0;
+	#ifndef NO_LOCK
+		pthread_t t;
+		if(pthread_create(&t, nullptr, run, &st) == 0) {
+			pthread_mutex_lock(&st.access);
+			while(st.writes < st.chunks) {
+				while(st.writes == st.reads && st.res == 0)
+					pthread_cond_wait(&st.wake, &st.access);
+				if((res = st.res))
+					break;
+				// the chunk is written while the reader fills the other buffer
+				const size_t c = st.writes;
+				pthread_mutex_unlock(&st.access);
+				res = out(&st.bufs[c & 1][0], (filesize)c * cp_chunk, st.size(c));
+				pthread_mutex_lock(&st.access);
+				if(res)
+					break;
+				st.writes++;
+				pthread_cond_signal(&st.wake);
+			}
+			st.cancel = true;
+			pthread_cond_signal(&st.wake);
+			pthread_mutex_unlock(&st.access);
+			pthread_join(t, nullptr);
+			return res;
+		}
+	#endif
+	// without a reader, chunks are read and written in turn
+	for(size_t c = 0; res == 0 && c < st.chunks; c++)
+		if((res = in(&st.bufs[0][0], (filesize)c * cp_chunk, st.size(c))) == 0)
+			res = out(&st.bufs[0][0], (filesize)c * cp_chunk, st.size(c));
+	return res;
+}
+
+int							importer::		tree(entry* top, const string& host) {
+	// level by level, so that the clusters of the directories come before the data of the files
+	vector<pair<entry*, struct stat> > made;
+	list<pair<entry*, string> > todo(1, make_pair(top, host));
+	for(; !todo.empty(); todo.pop_front()) {
+		DIR* d = opendir(todo.front().second.data());
+		if(d == nullptr) {
+			console::write((format("Can't read directory %s.\n") % todo.front().second).str(), true);
+			return errno;
+		}
+		vector<string> names;
+		for(struct dirent* i = readdir(d); i != nullptr; i = readdir(d)) {
+			if(strcmp(i->d_name, ".") != 0 && strcmp(i->d_name, "..") != 0)
+				names.push_back(i->d_name);
+		}
+		closedir(d);
+		sort(names.begin(), names.end());
+		for(const string& n: names) {
+			const string h = todo.front().second + sepdir + n;
+			struct stat st;
+			if(lstat(h.data(), &st) != 0 || !(S_ISDIR(st.st_mode) || S_ISREG(st.st_mode))) {
+				console::write((format("%s skipped, not a file or a directory.\n") % h).str(), true);
+				continue;
+			}
+			if(n.size() > name_size) {
+				console::write((format("%s skipped, name too long.\n") % h).str(), true);
+				continue;
+			}
+			// files are empty for now, their chains are allocated once the tree is done
+			entry* e = new entry(n, 0, S_ISDIR(st.st_mode));
+			if(e->flags.dir && e->cluster == 0) {
+				delete e;
+				console::write("No space left on device, disk full.\n", true);
+				return ENOSPC;
+			}
+			e->creation(st.st_mtime);
+			e->access(st.st_atime);
+			e->update(st.st_mtime);
+			int res = todo.front().first->addtodir(e);
+			if(res) {
+				delete e;
+				console::write((format("Can't add %s.\n") % h).str(), true);
+				return res;
+			}
+			if(e->flags.dir) {
+				todo.push_back(make_pair(e, h));
+				made.push_back(make_pair(e, st));
+				dirs++;
+			}
+			else
+				files.push_back({e, h, (filesize)st.st_size, st.st_atime, st.st_mtime});
+		}
+	}
+	// adding childs changed the dates of the directories
+	for(pair<entry*, struct stat>& i: made) {
+		i.first->access(i.second.st_atime);
+		i.first->update(i.second.st_mtime);
+		i.first->save();
+	}
 	return 0;
 }
-static int					fatx_truncate	(const char* path, off_t size) {
+void*						importer::		run(void* p) {
+	importer& imp = *(importer*)p;
+	for(size_t i = imp.next++; i < imp.files.size() && imp.err == 0; i = imp.next++) {
+		const job& j = imp.files[i];
+		if(j.size == 0)
+			continue;
+		ifstream s(j.host.data(), ios::binary);
+		int res = !s ? EIO : streamer::copy(j.size, [&s] (char* b, filesize o, size_t c) -> int {
+			s.seekg(o, ios::beg);
+			s.read(b, c);
+			return s ? 0 : EIO;
+		}, clusters(j.ent));
+		if(res) {
+			int ok = 0;
+			imp.err.compare_exchange_strong(ok, res);
+		}
+	}
+	return nullptr;
+}
+streamer::io_t				importer::		clusters(entry* e) {
+	// the entry is already saved with its size and dates, only its clusters are written
+	return [e] (char* b, filesize o, size_t c) -> int {
+		for(const area& a: e->extents(c, o)) {
+			int res = fatx_context::get()->dev.write(a.pointer, b + a.offset - o, a.size);
+			if(res)
+				return res;
+		}
+		return 0;
+	};
+}
+int							importer::		populate(entry* top, const string& host) {
+	int res = tree(top, host);
+	console::write(".");
+	// the chains, one after the other behind the directories
+	for(job& j: files) {
+		if(res == 0 && j.size != 0 && (res = j.ent->resize(j.size)) == ENOSPC)
+			console::write("No space left on device, disk full.\n", true);
+		j.ent->access(j.atime);
+		j.ent->update(j.mtime);
+		j.ent->save();
+	}
+	console::write(".");
+	if(res == 0) {
+		sort(files.begin(), files.end(), [] (const job& a, const job& b) -> bool { return a.ent->cluster < b.ent->cluster; });
+		#ifndef NO_LOCK
+			vector<pthread_t> workers;
+			for(size_t i = 1; i < min<size_t>(cp_threads, files.size()); i++) {
+				pthread_t t;
+				if(pthread_create(&t, nullptr, run, this) == 0)
+					workers.push_back(t);
+			}
+		#endif
+		run(this);
+		#ifndef NO_LOCK
+			for(pthread_t t: workers)
+				pthread_join(t, nullptr);
+		#endif
+		res = err;
+	}
+	if(res) {
+		console::write("failed.\n");
+		return res;
+	}
+	console::write("done.\n");
+	console::write((format("%d directories and %d files copied.\n") % dirs % files.size()).str());
+	return 0;
+}
+
+int							exporter::		tree(entry* top, const string& host) {
+	// level by level, every directory is made before its childs
+	list<job> todo(1, job{top, host});
+	for(; !todo.empty(); todo.pop_front()) {
+		const job& d = todo.front();
+		if(mkdir(d.host.data(), S_IRWXU | S_IRWXG | S_IRWXO) != 0 && errno != EEXIST) {
+			console::write((format("Can't make directory %s.\n") % d.host).str(), true);
+			return errno;
+		}
+		if(d.ent != top)
+			dirs.push_back(d);
+		d.ent->load();
+		for(entry& e: d.ent->childs) {
+			// the volume name is not a file of the tree
+			if(e.status != entry::valid || e.flags.lab)
+				continue;
+			if(!safe(e)) {
+				console::write((format("%s%s%s skipped, invalid name.\n") % d.host % sepdir % e.name).str(), true);
+				continue;
+			}
+			if(e.flags.dir)
+				todo.push_back(job{&e, d.host + sepdir + e.name});
+			else
+				files.push_back(job{&e, d.host + sepdir + e.name});
+		}
+	}
+	return 0;
+}
+bool						exporter::		safe(const entry& e) {
+	// names come from the image, they must not lead out of the host directory
+	const size_t l = strlen(e.name);
+	return
+		l != 0 && l == e.namesize &&
+		strcmp(e.name, ".") != 0 && strcmp(e.name, "..") != 0 &&
+		strpbrk(e.name, sepdir) == nullptr;
+}
+void						exporter::		stamp(const job& j) {
+	struct utimbuf t;
+	t.actime	= j.ent->access();
+	t.modtime	= j.ent->update();
+	utime(j.host.data(), &t);
+}
+void*						exporter::		run(void* p) {
+	exporter& exp = *(exporter*)p;
+	for(size_t i = exp.next++; i < exp.files.size() && exp.err == 0; i = exp.next++) {
+		const job& j = exp.files[i];
+		ofstream f(j.host.data(), ios::binary | ios::trunc);
+		int res = !f ? EIO : streamer::copy(j.ent->size, [&j] (char* b, filesize o, size_t c) -> int {
+			return j.ent->data(b, true, o, c);
+		}, [&f] (char* b, filesize, size_t c) -> int {
+			f.write(b, c);
+			return f ? 0 : EIO;
+		});
+		f.close();
+		if(res) {
+			console::write((format("Can't write file %s locally.\n") % j.host).str(), true);
+			int ok = 0;
+			exp.err.compare_exchange_strong(ok, res);
+		}
+		else
+			stamp(j);
+	}
+	return nullptr;
+}
+int							exporter::		extract(entry* top, const string& host) {
+	int res = tree(top, host);
+	if(res)
+		return res;
+	// head moves of the device follow the clusters, whatever the order of the tree
+	sort(files.begin(), files.end(), [] (const job& a, const job& b) -> bool { return a.ent->cluster < b.ent->cluster; });
+	#ifndef NO_LOCK
+		vector<pthread_t> workers;
+		for(size_t i = 1; i < min<size_t>(cp_threads, files.size()); i++) {
+			pthread_t t;
+			if(pthread_create(&t, nullptr, run, this) == 0)
+				workers.push_back(t);
+		}
+	#endif
+	run(this);
+	#ifndef NO_LOCK
+		for(pthread_t t: workers)
+			pthread_join(t, nullptr);
+	#endif
+	// files made in a directory changed its dates, the deepest ones are done first
+	for(vector<job>::reverse_iterator i = dirs.rbegin(); i != dirs.rend(); i++)
+		stamp(*i);
+	return err;
+}
+
+void						tarball::		octal(char* f, size_t l, uint64_t v) {
+	// digits padded with zeros, then a null
+	for(size_t i = l - 1; i-- > 0; v >>= 3)
+		f[i] = '0' + (v & 7);
+	f[l - 1] = '\0';
+}
+uint64_t					tarball::		number(const char* f, size_t l) {
+	uint64_t res = 0;
+	size_t i = 0;
+	for(; i < l && (f[i] == ' ' || f[i] == '\0'); i++);
+	for(; i < l && f[i] >= '0' && f[i] <= '7'; i++)
+		res = (res << 3) | (f[i] - '0');
+	return res;
+}
+int							tarball::		head(ostream& out, const string& p, const entry& e) {
+	char h[blk];
+	memset(h, '\0', blk);
+	if(p.size() > 100) {
+		// a long path is cut at a separator, the first part in the prefix field
+		size_t k = p.find(sepdir, p.size() - 101);
+		if(k == string::npos || k > 155 || k + 1 + e.flags.dir >= p.size()) {
+			console::write((format("%s skipped, path too long.\n") % p).str(), true);
+			return ENAMETOOLONG;
+		}
+		memcpy(h + 345, p.data(), k);
+		memcpy(h, p.data() + k + 1, p.size() - k - 1);
+	}
+	else
+		memcpy(h, p.data(), p.size());
+	octal(h + 100, 8, e.flags.dir ? 0755 : e.flags.ro ? 0444 : 0644);
+	octal(h + 108, 8, 0);
+	octal(h + 116, 8, 0);
+	octal(h + 124, 12, e.flags.dir ? 0 : e.size);
+	octal(h + 136, 12, e.update());
+	memset(h + 148, ' ', 8);
+	h[156] = e.flags.dir ? '5' : '0';
+	memcpy(h + 257, "ustar", 6);
+	memcpy(h + 263, "00", 2);
+	unsigned int sum = 0;
+	for(size_t i = 0; i < blk; i++)
+		sum += (unsigned char)h[i];
+	octal(h + 148, 7, sum);
+	out.write(h, blk);
+	return out ? 0 : EIO;
+}
+int							tarball::		create(entry* top, ostream& out) {
+	// directories level by level, then the files in the order of their clusters
+	vector<pair<entry*, string> > dirs;
+	vector<pair<entry*, string> > files;
+	list<pair<entry*, string> > todo(1, make_pair(top, string()));
+	for(; !todo.empty(); todo.pop_front()) {
+		todo.front().first->load();
+		for(entry& e: todo.front().first->childs) {
+			if(e.status != entry::valid || e.flags.lab)
+				continue;
+			if(!exporter::safe(e)) {
+				console::write((format("%s%s skipped, invalid name.\n") % todo.front().second % e.name).str(), true);
+				continue;
+			}
+			const string p = todo.front().second + e.name;
+			if(e.flags.dir) {
+				dirs.push_back(make_pair(&e, p + sepdir));
+				todo.push_back(dirs.back());
+			}
+			else
+				files.push_back(make_pair(&e, p));
+		}
+	}
+	sort(files.begin(), files.end(), [] (const pair<entry*, string>& a, const pair<entry*, string>& b) -> bool { return a.first->cluster < b.first->cluster; });
+	int res = 0;
+	for(const pair<entry*, string>& d: dirs) {
+		if((res = head(out, d.second, *d.first)) == EIO)
+			return res;
+	}
+	for(const pair<entry*, string>& f: files) {
+		if((res = head(out, f.second, *f.first)) == ENAMETOOLONG)
+			continue;
+		entry* e = f.first;
+		if(res == 0)
+			res = streamer::copy(e->size, [e] (char* b, filesize o, size_t c) -> int {
+				return e->data(b, true, o, c);
+			}, [&out] (char* b, filesize, size_t c) -> int {
+				out.write(b, c);
+				return out ? 0 : EIO;
+			});
+		if(res) {
+			console::write((format("Can't write %s in the tar stream.\n") % f.second).str(), true);
+			return res;
+		}
+		out.write(string((blk - e->size % blk) % blk, '\0').data(), (blk - e->size % blk) % blk);
+	}
+	// end of archive
+	out.write(string(2 * blk, '\0').data(), 2 * blk);
+	out.flush();
+	return out ? 0 : EIO;
+}
+entry*						tarball::		make(entry* top, const string& p, bool dir, filesize s) {
+	// missing directories of the path are made on the way
+	entry* d = top;
+	vector<string> parts;
+	// as GNU tar, members out of the tree are refused: absolute paths, empty or parent components
+	const size_t l = p.size() - (p.size() > 1 && p.compare(p.size() - strlen(sepdir), string::npos, sepdir) == 0 ? strlen(sepdir) : 0);
+	for(size_t b = 0, e = 0; b <= l; b = e + strlen(sepdir)) {
+		e = min<size_t>(p.find(sepdir, b), l);
+		const string n = p.substr(b, e - b);
+		if(n.empty() || n == "..") {
+			console::write((format("%s skipped, invalid path.\n") % p).str(), true);
+			return nullptr;
+		}
+		if(n != ".")
+			parts.push_back(n);
+	}
+	if(parts.empty())
+		return nullptr;
+	for(size_t i = 0; i < parts.size(); i++) {
+		if(parts[i].size() > name_size) {
+			console::write((format("%s skipped, name too long.\n") % p).str(), true);
+			return nullptr;
+		}
+		entry* e = d->find(parts[i].data());
+		const bool last = i == parts.size() - 1;
+		if(e != nullptr) {
+			if(last && !(dir && e->flags.dir)) {
+				console::write((format("%s skipped, already in the volume.\n") % p).str(), true);
+				return nullptr;
+			}
+			if(!e->flags.dir) {
+				console::write((format("%s skipped, %s is a file.\n") % p % parts[i]).str(), true);
+				return nullptr;
+			}
+			d = e;
+			continue;
+		}
+		// the whole chain of a file is allocated before its data is read
+		e = new entry(parts[i], last ? s : 0, !last || dir);
+		if((e->flags.dir || s != 0) && e->cluster == 0) {
+			delete e;
+			console::write("No space left on device, disk full.\n", true);
+			return nullptr;
+		}
+		if(d->addtodir(e)) {
+			delete e;
+			console::write((format("Can't add %s.\n") % p).str(), true);
+			return nullptr;
+		}
+		d = e;
+	}
+	return d;
+}
+int							tarball::		extract(entry* top, istream& in) {
+	char h[blk];
+	size_t dirs = 0;
+	size_t files = 0;
+	string longname;
+	vector<pair<entry*, time_t> > dates;
+	bool end = false;
+	while(in.read(h, blk)) {
+		if((end = all_of(h, h + blk, [] (const char c) -> bool { return c == '\0'; })))
+			break;
+		unsigned int sum = 0;
+		for(size_t i = 0; i < blk; i++)
+			sum += (i >= 148 && i < 156) ? ' ' : (unsigned char)h[i];
+		if(sum != number(h + 148, 8)) {
+			console::write("failed.\nBad header in the tar stream.\n");
+			return EINVAL;
+		}
+		const filesize s = number(h + 124, 12);
+		const time_t m = number(h + 136, 12);
+		if(h[156] == 'L' || h[156] == 'x' || h[156] == 'g') {
+			// a long name of GNU or pax archives comes as the data of an extra header, for the next one
+			if(s > meta) {
+				console::write("failed.\nBad header in the tar stream.\n");
+				return EINVAL;
+			}
+			string d(s, '\0');
+			if(!in.read(&d[0], s)) {
+				console::write("failed.\nBad header in the tar stream.\n");
+				return EINVAL;
+			}
+			in.ignore((blk - s % blk) % blk);
+			if(h[156] == 'L')
+				longname = d.c_str();
+			for(size_t i = 0, l = 0; h[156] == 'x' && i < d.size(); i += l) {
+				// records of pax headers are "length key=value\n"
+				size_t k = d.find(' ', i);
+				if(k == string::npos || (l = strtoul(&d[i], nullptr, 10)) <= k + 1 - i || i + l > d.size())
+					break;
+				if(d.compare(k + 1, 5, "path=") == 0)
+					longname = d.substr(k + 6, i + l - k - 7);
+			}
+			continue;
+		}
+		string p(h + 345, strnlen(h + 345, 155));
+		if(!p.empty())
+			p += sepdir;
+		p.append(h, strnlen(h, 100));
+		if(!longname.empty()) {
+			p.swap(longname);
+			longname.clear();
+		}
+		const bool dir = h[156] == '5';
+		entry* e = nullptr;
+		if(dir || h[156] == '0' || h[156] == '\0')
+			e = make(top, p, dir, dir ? 0 : s);
+		else
+			console::write((format("%s skipped, not a file or a directory.\n") % p).str(), true);
+		if(e != nullptr && !dir) {
+			e->access(m);
+			e->update(m);
+			e->save();
+			int res = streamer::copy(s, [&in] (char* b, filesize, size_t c) -> int {
+				in.read(b, c);
+				return in ? 0 : EIO;
+			}, importer::clusters(e));
+			if(res) {
+				console::write("failed.\n");
+				return res;
+			}
+			files++;
+		}
+		else {
+			in.ignore(dir ? 0 : s);
+			if(e != nullptr) {
+				dates.push_back(make_pair(e, m));
+				dirs++;
+			}
+		}
+		in.ignore((blk - s % blk) % blk);
+	}
+	if(in.bad() || (!end && in.gcount() != 0)) {
+		console::write("failed.\nTruncated tar stream.\n");
+		return EIO;
+	}
+	// adding childs changed the dates of the directories
+	for(pair<entry*, time_t>& i: dates) {
+		i.first->access(i.second);
+		i.first->update(i.second);
+		i.first->save();
+	}
+	console::write("...done.\n");
+	console::write((format("%d directories and %d files copied.\n") % dirs % files).str());
+	return 0;
+}
+
+							prefetcher::	prefetcher() : busy(nullptr), running(false) {
+	#ifndef NO_LOCK
+		pthread_mutex_init(&access, nullptr);
+		pthread_cond_init(&wake, nullptr);
+		pthread_cond_init(&idle, nullptr);
+	#endif
+}
+							prefetcher::	~prefetcher() {
+	stop();
+	#ifndef NO_LOCK
+		pthread_cond_destroy(&idle);
+		pthread_cond_destroy(&wake);
+		pthread_mutex_destroy(&access);
+	#endif
+}
+void						prefetcher::	start() {
+	#ifndef NO_LOCK
+		if(running || fatx_context::get()->mmi.prog != frontend::fuse)
+			return;
+		running = true;
+		if(pthread_create(&worker, nullptr, run, this))
+			running = false;
+	#endif
+}
+void						prefetcher::	stop() {
+	#ifndef NO_LOCK
+		if(!running)
+			return;
+		pthread_mutex_lock(&access);
+		running = false;
+		jobs.clear();
+		pthread_cond_signal(&wake);
+		pthread_mutex_unlock(&access);
+		pthread_join(worker, nullptr);
+	#endif
+}
+#ifndef NO_LOCK
+void*						prefetcher::	run(void* p) {
+	prefetcher& pf = *(prefetcher*)p;
+	pthread_mutex_lock(&pf.access);
+	while(true) {
+		while(pf.running && pf.jobs.empty())
+			pthread_cond_wait(&pf.wake, &pf.access);
+		if(!pf.running)
+			break;
+		job j = pf.jobs.front();
+		pf.jobs.pop_front();
+		pf.busy = j.ent;
+		pthread_mutex_unlock(&pf.access);
+		j.ent->prefetch(j.offset, j.size);
+		pthread_mutex_lock(&pf.access);
+		pf.busy = nullptr;
+		pthread_cond_broadcast(&pf.idle);
+	}
+	pthread_mutex_unlock(&pf.access);
+	return nullptr;
+}
+#endif
+void						prefetcher::	push(entry* e, filesize o, filesize s) {
+	#ifndef NO_LOCK
+		if(!running)
+			return;
+		pthread_mutex_lock(&access);
+		jobs.push_back(job{e, o, s});
+		pthread_cond_signal(&wake);
+		pthread_mutex_unlock(&access);
+	#else
+		(void) e;
+		(void) o;
+		(void) s;
+	#endif
+}
+void						prefetcher::	cancel(entry* e) {
+	#ifndef NO_LOCK
+		if(!running)
+			return;
+		pthread_mutex_lock(&access);
+		jobs.remove_if([e] (const job& j) -> bool {
+			return j.ent == e;
+		});
+		while(busy == e)
+			pthread_cond_wait(&idle, &access);
+		pthread_mutex_unlock(&access);
+	#else
+		(void) e;
+	#endif
+}
+
+							notifier::		notifier() : target(nullptr), running(false) {
+	#ifndef NO_LOCK
+		pthread_mutex_init(&access, nullptr);
+		pthread_cond_init(&wake, nullptr);
+	#endif
+}
+							notifier::		~notifier() {
+	stop();
+	#ifndef NO_LOCK
+		pthread_cond_destroy(&wake);
+		pthread_mutex_destroy(&access);
+	#endif
+}
+void						notifier::		attach(void* t) {
+	target = t;
+}
+void						notifier::		start() {
+	// without threads, nothing is sent and the kernel keeps entries for a short time only
+	#ifndef NO_LOCK
+		if(running || target == nullptr)
+			return;
+		running = true;
+		if(pthread_create(&worker, nullptr, run, this))
+			running = false;
+	#endif
+}
+void						notifier::		stop() {
+	#ifndef NO_LOCK
+		if(!running)
+			return;
+		pthread_mutex_lock(&access);
+		running = false;
+		attrs.clear();
+		names.clear();
+		pthread_cond_signal(&wake);
+		pthread_mutex_unlock(&access);
+		pthread_join(worker, nullptr);
+	#endif
+}
+#ifndef NO_LOCK
+void*						notifier::		run(void* p) {
+	notifier& nt = *(notifier*)p;
+	pthread_mutex_lock(&nt.access);
+	while(true) {
+		while(nt.running && nt.attrs.empty() && nt.names.empty())
+			pthread_cond_wait(&nt.wake, &nt.access);
+		if(!nt.running)
+			break;
+		set<uint64_t> a;
+		list<pair<uint64_t, string>> n;
+		a.swap(nt.attrs);
+		n.swap(nt.names);
+		pthread_mutex_unlock(&nt.access);
+		#if !defined NO_FUSE && !defined NO_FUSE_CALL
+			#ifdef HAVE_FUSE3
+				struct fuse_session* t = (struct fuse_session*)nt.target;
+			#else
+				struct fuse_chan* t = (struct fuse_chan*)nt.target;
+			#endif
+			// an unknown inode or name is not an error, the kernel may have dropped it
+			for(const pair<uint64_t, string>& i: n)
+				fuse_lowlevel_notify_inval_entry(t, i.first, i.second.data(), i.second.size());
+			for(uint64_t i: a)
+				fuse_lowlevel_notify_inval_inode(t, i, -1, 0);
+		#endif
+		pthread_mutex_lock(&nt.access);
+	}
+	pthread_mutex_unlock(&nt.access);
+	return nullptr;
+}
+#endif
+void						notifier::		attr(const entry* e) {
+	#ifndef NO_LOCK
+		if(!running)
+			return;
+		uint64_t n = fatx_context::get()->nodes.known(e);
+		if(n == 0)
+			return;
+		pthread_mutex_lock(&access);
+		attrs.insert(n);
+		pthread_cond_signal(&wake);
+		pthread_mutex_unlock(&access);
+	#else
+		(void) e;
+	#endif
+}
+void						notifier::		name(const entry* d, const entry* e) {
+	#ifndef NO_LOCK
+		if(!running)
+			return;
+		// lookups are case insensitive, the kernel may hold the entry under other cases of its name
+		set<string> c = fatx_context::get()->nodes.unalias(e);
+		uint64_t p = fatx_context::get()->nodes.known(d);
+		if(p == 0)
+			return;
+		pthread_mutex_lock(&access);
+		names.push_back(make_pair(p, string(e->name)));
+		for(const string& i: c)
+			names.push_back(make_pair(p, i));
+		pthread_cond_signal(&wake);
+		pthread_mutex_unlock(&access);
+	#else
+		(void) d;
+		(void) e;
+	#endif
+}
+
+							flusher::		flusher() : running(false) {
+	#ifndef NO_LOCK
+		started = 0;
+		pthread_mutex_init(&access, nullptr);
+		pthread_cond_init(&wake, nullptr);
+		pthread_cond_init(&idle, nullptr);
+	#endif
+}
+							flusher::		~flusher() {
+	stop();
+	#ifndef NO_LOCK
+		pthread_cond_destroy(&idle);
+		pthread_cond_destroy(&wake);
+		pthread_mutex_destroy(&access);
+	#endif
+}
+void						flusher::		start() {
+	#ifndef NO_LOCK
+		if(running || fatx_context::get()->mmi.prog != frontend::fuse || !fatx_context::get()->mmi.writeable())
+			return;
+		running = true;
+		// fewer threads will do, but one is needed
+		for(started = 0; started < wb_threads && pthread_create(&workers[started], nullptr, run, this) == 0; started++);
+		if(started == 0)
+			running = false;
+	#endif
+}
+void						flusher::		stop() {
+	#ifndef NO_LOCK
+		if(!running)
+			return;
+		// pages left dirty are written by the last flush of their file
+		pthread_mutex_lock(&access);
+		running = false;
+		jobs.clear();
+		pthread_cond_broadcast(&wake);
+		pthread_cond_broadcast(&idle);
+		pthread_mutex_unlock(&access);
+		for(unsigned int i = 0; i < started; i++)
+			pthread_join(workers[i], nullptr);
+		started = 0;
+	#endif
+}
+#ifndef NO_LOCK
+void*						flusher::		run(void* p) {
+	flusher& fl = *(flusher*)p;
+	pthread_mutex_lock(&fl.access);
+	while(true) {
+		while(fl.running && fl.jobs.empty())
+			pthread_cond_wait(&fl.wake, &fl.access);
+		if(!fl.running)
+			break;
+		job j = fl.jobs.front();
+		fl.jobs.pop_front();
+		fl.busy.insert(j.ent);
+		pthread_mutex_unlock(&fl.access);
+		#if defined DEBUG && defined DBG_BUFFER
+			int res =
+		#endif
+		j.ent->writebehind(j.page);
+		#if defined DEBUG && defined DBG_BUFFER
+			dbglog((format("... write behind: %s page %d (%d)\n") % j.ent->path() % j.page % res).str())
+		#endif
+		pthread_mutex_lock(&fl.access);
+		fl.busy.erase(fl.busy.find(j.ent));
+		pthread_cond_broadcast(&fl.idle);
+	}
+	pthread_mutex_unlock(&fl.access);
+	return nullptr;
+}
+#endif
+bool						flusher::		pending(entry* e) const {
+	return busy.count(e) != 0 || find_if(jobs.begin(), jobs.end(), [e] (const job& j) -> bool {
+		return j.ent == e;
+	}) != jobs.end();
+}
+void						flusher::		push(entry* e, filesize i) {
+	#ifndef NO_LOCK
+		if(!running)
+			return;
+		pthread_mutex_lock(&access);
+		jobs.push_back(job{e, i});
+		pthread_cond_signal(&wake);
+		pthread_mutex_unlock(&access);
+	#else
+		(void) e;
+		(void) i;
+	#endif
+}
+void						flusher::		begin(entry* e) {
+	#ifndef NO_LOCK
+		pthread_mutex_lock(&access);
+		io.insert(e);
+		pthread_mutex_unlock(&access);
+	#else
+		(void) e;
+	#endif
+}
+void						flusher::		end(entry* e) {
+	#ifndef NO_LOCK
+		pthread_mutex_lock(&access);
+		io.erase(io.find(e));
+		pthread_cond_broadcast(&idle);
+		pthread_mutex_unlock(&access);
+	#else
+		(void) e;
+	#endif
+}
+void						flusher::		wait(entry* e) {
+	#ifndef NO_LOCK
+		if(!running)
+			return;
+		pthread_mutex_lock(&access);
+		while(running && pending(e))
+			pthread_cond_wait(&idle, &access);
+		pthread_mutex_unlock(&access);
+	#else
+		(void) e;
+	#endif
+}
+void						flusher::		drain(entry* e) {
+	// caller may hold the lock of the entry: only device writes are waited for
+	#ifndef NO_LOCK
+		if(!running)
+			return;
+		pthread_mutex_lock(&access);
+		while(io.count(e) != 0)
+			pthread_cond_wait(&idle, &access);
+		pthread_mutex_unlock(&access);
+	#else
+		(void) e;
+	#endif
+}
+void						flusher::		cancel(entry* e) {
+	#ifndef NO_LOCK
+		if(!running)
+			return;
+		pthread_mutex_lock(&access);
+		jobs.remove_if([e] (const job& j) -> bool {
+			return j.ent == e;
+		});
+		pthread_mutex_unlock(&access);
+		drain(e);
+	#else
+		(void) e;
+	#endif
+}
+void						flusher::		throttle() {
+	// writers wait while too many pages are dirty and the flusher can clean some
+	#ifndef NO_LOCK
+		if(!running)
+			return;
+		pthread_mutex_lock(&access);
+		while(running && fatx_context::get()->pool.overdirty() && !(jobs.empty() && busy.empty()))
+			pthread_cond_wait(&idle, &access);
+		pthread_mutex_unlock(&access);
+	#endif
+}
+
+							dirclusters::	dirclusters() : running(false) {
+	#ifndef NO_LOCK
+		pthread_mutex_init(&access, nullptr);
+		pthread_cond_init(&wake, nullptr);
+	#endif
+}
+							dirclusters::	~dirclusters() {
+	stop();
+	#ifndef NO_LOCK
+		pthread_cond_destroy(&wake);
+		pthread_mutex_destroy(&access);
+	#endif
+}
+void						dirclusters::	start() {
+	#ifndef NO_LOCK
+		if(running || fatx_context::get()->mmi.prog != frontend::fuse || fatx_context::get()->mmi.dirsync != "delay")
+			return;
+		running = true;
+		if(pthread_create(&worker, nullptr, run, this))
+			running = false;
+	#endif
+}
+void						dirclusters::	stop() {
+	#ifndef NO_LOCK
+		if(!running)
+			return;
+		pthread_mutex_lock(&access);
+		running = false;
+		pthread_cond_signal(&wake);
+		pthread_mutex_unlock(&access);
+		pthread_join(worker, nullptr);
+	#endif
+}
+#ifndef NO_LOCK
+void*						dirclusters::	run(void* p) {
+	dirclusters& dc = *(dirclusters*)p;
+	pthread_mutex_lock(&dc.access);
+	while(dc.running) {
+		struct timespec t;
+		clock_gettime(CLOCK_REALTIME, &t);
+		t.tv_sec += dir_delay;
+		pthread_cond_timedwait(&dc.wake, &dc.access, &t);
+		if(dc.running)
+			dc.writeback();
+	}
+	pthread_mutex_unlock(&dc.access);
+	return nullptr;
+}
+#endif
+bool						dirclusters::	delayed() const {
+	// checks and recoveries write at once what they repair
+	const frontend& mmi = fatx_context::get()->mmi;
+	return mmi.dirsync != "always" && mmi.prog != frontend::fsck && mmi.prog != frontend::unrm;
+}
+int							dirclusters::	writeback() {
+	// caller holds the lock, contiguous dirty clusters are written at once
+	const fatxpar& par = fatx_context::get()->par;
+	int res = 0;
+	for(clusters_t::iterator i = clusters.begin(); i != clusters.end(); ) {
+		if(!i->second.dirty) {
+			i++;
+			continue;
+		}
+		clusters_t::iterator j = i;
+		string buf;
+		for(; j != clusters.end() && j->second.dirty && j->first == i->first + buf.size() / par.clus_size; j++)
+			buf += j->second.data;
+		#ifdef DEBUG
+			dbglog((format("<-> write back directory clusters 0x%08X: %d\n") % i->first % (buf.size() / par.clus_size)).str())
+		#endif
+		int r = fatx_context::get()->dev.write(clsarithm::cls2ptr(i->first), buf);
+		for(; i != j; i++)
+			i->second.dirty = r != 0;
+		if(r != 0)
+			res = r;
+	}
+	return res;
+}
+string						dirclusters::	read(const clusptr& c) {
+	#ifndef NO_LOCK
+		pthread_mutex_lock(&access);
+	#endif
+	clusters_t::const_iterator it = clusters.find(c);
+	const bool found = it != clusters.end();
+	string res = found ? it->second.data : string();
+	#ifndef NO_LOCK
+		pthread_mutex_unlock(&access);
+	#endif
+	return found ? res : fatx_context::get()->dev.read(clsarithm::cls2ptr(c), fatx_context::get()->par.clus_size);
+}
+int							dirclusters::	write(const streamptr& loc, const string& buf) {
+	// the change is applied to the cluster in memory, read once from the device
+	if(!delayed())
+		return fatx_context::get()->dev.write(loc, buf);
+	const size_t clus = fatx_context::get()->par.clus_size;
+	const clusptr c = clsarithm::ptr2cls(loc);
+	const streamptr o = loc - clsarithm::cls2ptr(c);
+	if(o + buf.size() > clus)
+		return EFAULT;
+	int res = 0;
+	#ifndef NO_LOCK
+		pthread_mutex_lock(&access);
+	#endif
+	clusters_t::iterator it = clusters.find(c);
+	if(it == clusters.end()) {
+		if(clusters.size() >= max_dirclus) {
+			// clean clusters go first, all of them are made clean when none is
+			clusters_t::iterator e = clusters.begin();
+			while(e != clusters.end() && e->second.dirty)
+				e++;
+			if(e == clusters.end() && (res = writeback()) == 0)
+				e = clusters.begin();
+			if(e != clusters.end())
+				clusters.erase(e);
+		}
+		cluster n = {fatx_context::get()->dev.read(clsarithm::cls2ptr(c), clus), false};
+		if(res == 0 && n.data.size() == clus)
+			it = clusters.insert(make_pair(c, n)).first;
+		else if(res == 0)
+			res = EIO;
+	}
+	if(res == 0) {
+		memcpy(&it->second.data[o], buf.data(), buf.size());
+		it->second.dirty = true;
+	}
+	#ifndef NO_LOCK
+		pthread_mutex_unlock(&access);
+	#endif
+	return res;
+}
+int							dirclusters::	release(const clusptr& c) {
+	// deleted entries stay on the device for recoveries
+	int res = 0;
+	#ifndef NO_LOCK
+		pthread_mutex_lock(&access);
+	#endif
+	clusters_t::iterator it = clusters.find(c);
+	if(it != clusters.end()) {
+		if(it->second.dirty)
+			res = fatx_context::get()->dev.write(clsarithm::cls2ptr(c), it->second.data);
+		clusters.erase(it);
+	}
+	#ifndef NO_LOCK
+		pthread_mutex_unlock(&access);
+	#endif
+	return res;
+}
+int							dirclusters::	sync(const clusptr& c) {
+	// written at once, and kept for the next changes
+	int res = 0;
+	#ifndef NO_LOCK
+		pthread_mutex_lock(&access);
+	#endif
+	clusters_t::iterator it = clusters.find(c);
+	if(it != clusters.end() && it->second.dirty) {
+		res = fatx_context::get()->dev.write(clsarithm::cls2ptr(c), it->second.data);
+		if(res == 0)
+			it->second.dirty = false;
+	}
+	#ifndef NO_LOCK
+		pthread_mutex_unlock(&access);
+	#endif
+	return res;
+}
+int							dirclusters::	flush() {
+	#ifndef NO_LOCK
+		pthread_mutex_lock(&access);
+	#endif
+	int res = writeback();
+	#ifndef NO_LOCK
+		pthread_mutex_unlock(&access);
+	#endif
+	return res;
+}
+
+string						dentries::		fold(const string& p) {
+	string res(p);
+	if(res.size() > 1 && res.compare(res.size() - strlen(sepdir), string::npos, sepdir) == 0)
+		res.erase(res.size() - strlen(sepdir));
+	return res;
+}
+entry*						dentries::		find(const char* path) {
+	key_t k(string(), fold(path));
+	k.first = k.second;
+	transform(k.first.begin(), k.first.end(), k.first.begin(), ::tolower);
+	{
+		#ifndef NO_LOCK
+			sharable_lock<mutex> lock(access);
+		#endif
+		paths_t::iterator it = paths.find(k);
+		if(it != paths.end()) {
+			it->second.used = true;
+			return it->second.ent;
+		}
+	}
+	// a path changed during the walk is not cached
+	uint64_t g = gen;
+	entry* res = fatx_context::get()->root->find(path);
+	#ifndef NO_LOCK
+		scoped_lock<mutex> lock(access);
+	#endif
+	if(g == gen) {
+		const bool fresh = paths.count(k) == 0;
+		if(fresh && paths.size() >= max_dentries)
+			evict();
+		dentry_t& d = paths[k];
+		if(fresh)
+			d.age = ages.insert(ages.end(), k);
+		d.ent	= res;
+		d.used	= false;
+	}
+	return res;
+}
+void						dentries::		evict() {
+	// caller holds the lock, the oldest path not found again goes
+	while(!ages.empty()) {
+		paths_t::iterator it = paths.find(ages.front());
+		if(!it->second.used) {
+			ages.pop_front();
+			paths.erase(it);
+			return;
+		}
+		it->second.used = false;
+		ages.splice(ages.end(), ages, ages.begin());
+	}
+}
+void						dentries::		forget(entry* e) {
+	// the entry, and the paths below it, found or not
+	string f = fold(e->path());
+	transform(f.begin(), f.end(), f.begin(), ::tolower);
+	const bool cut = strlen(e->name) == name_size && fatx_context::get()->mmi.cutname;
+	#ifndef NO_LOCK
+		scoped_lock<mutex> lock(access);
+	#endif
+	gen++;
+	paths_t::iterator it = paths.lower_bound(make_pair(f, string()));
+	while(it != paths.end() && it->first.first.compare(0, f.size(), f) == 0) {
+		const string& k = it->first.first;
+		// with truncated names, longer names of the last component resolve to this entry
+		if(cut || k.size() == f.size() || k.compare(f.size(), strlen(sepdir), sepdir) == 0 || f == sepdir) {
+			ages.erase(it->second.age);
+			paths.erase(it++);
+		}
+		else
+			it++;
+	}
+}
+void						dentries::		clear() {
+	#ifndef NO_LOCK
+		scoped_lock<mutex> lock(access);
+	#endif
+	gen++;
+	paths.clear();
+	ages.clear();
+}
+uint64_t					inodes::		get(entry* e, bool lookup) {
+	// the root is number 1, others are numbered by the location of their entry, kept while looked up
+	if(e == fatx_context::get()->root)
+		return 1;
+	#ifndef NO_LOCK
+		scoped_lock<mutex> lock(access);
+	#endif
+	unordered_map<entry*, uint64_t>::iterator it = numbers.find(e);
+	if(it != numbers.end()) {
+		if(lookup)
+			nodes[it->second].second++;
+		return it->second;
+	}
+	uint64_t n = e->loc / entry::ent_size;
+	if(!lookup)
+		return n;
+	if(n < 2 || nodes.count(n) != 0)
+		n = next++;
+	nodes[n] = make_pair(e, 1);
+	numbers[e] = n;
+	return n;
+}
+uint64_t					inodes::		known(const entry* e) {
+	// 0 when the kernel does not know the entry
+	if(e == fatx_context::get()->root)
+		return 1;
+	#ifndef NO_LOCK
+		sharable_lock<mutex> lock(access);
+	#endif
+	unordered_map<entry*, uint64_t>::const_iterator it = numbers.find(const_cast<entry*>(e));
+	return it != numbers.end() ? it->second : 0;
+}
+entry*						inodes::		find(uint64_t n) {
+	if(n == 1)
+		return fatx_context::get()->root;
+	#ifndef NO_LOCK
+		sharable_lock<mutex> lock(access);
+	#endif
+	unordered_map<uint64_t, node_t>::const_iterator it = nodes.find(n);
+	return it != nodes.end() ? it->second.first : nullptr;
+}
+void						inodes::		alias(uint64_t n, const char* a) {
+	#ifndef NO_LOCK
+		scoped_lock<mutex> lock(access);
+	#endif
+	if(nodes.count(n) != 0)
+		cases[n].insert(a);
+}
+set<string>					inodes::		unalias(const entry* e) {
+	// the other cases are taken once, the kernel drops them when notified
+	set<string> res;
+	#ifndef NO_LOCK
+		scoped_lock<mutex> lock(access);
+	#endif
+	unordered_map<entry*, uint64_t>::const_iterator it = numbers.find(const_cast<entry*>(e));
+	if(it == numbers.end())
+		return res;
+	unordered_map<uint64_t, set<string>>::iterator c = cases.find(it->second);
+	if(c != cases.end()) {
+		res.swap(c->second);
+		cases.erase(c);
+	}
+	return res;
+}
+void						inodes::		forget(uint64_t n, uint64_t c) {
+	#ifndef NO_LOCK
+		scoped_lock<mutex> lock(access);
+	#endif
+	unordered_map<uint64_t, node_t>::iterator it = nodes.find(n);
+	if(it == nodes.end())
+		return;
+	if(it->second.second > c) {
+		it->second.second -= c;
+		return;
+	}
+	numbers.erase(it->second.first);
+	cases.erase(n);
+	nodes.erase(it);
+}
+void						inodes::		clear() {
+	#ifndef NO_LOCK
+		scoped_lock<mutex> lock(access);
+	#endif
+	nodes.clear();
+	numbers.clear();
+	cases.clear();
+}
+
+template<typename T>
+static bool					snapget			(const char*& p, const char* e, T& v) {
+	if(e - p < (ptrdiff_t)sizeof(T))
+		return false;
+	memcpy(&v, p, sizeof(T));
+	p += sizeof(T);
+	return true;
+}
+template<typename T>
+static void					snapput			(string& b, const T& v) {
+	b.append((const char*)&v, sizeof(T));
+}
+bool						snapshot::		stamp(string& b) {
+	// the image file changes its time and size with any write, a device node does not
+	struct stat st;
+	if(stat(fatx_context::get()->mmi.input.data(), &st) != 0 || !S_ISREG(st.st_mode))
+		return false;
+	snapput(b, (uint64_t)st.st_ino);
+	snapput(b, (uint64_t)st.st_size);
+	snapput(b, (uint64_t)st.st_mtim.tv_sec);
+	snapput(b, (uint64_t)st.st_mtim.tv_nsec);
+	return true;
+}
+string						snapshot::		file() const {
+	return (format("%s/%08X") % fatx_context::get()->mmi.snapdir % fatx_context::get()->par.par_id).str();
+}
+void						snapshot::		unmap() {
+	dirs.clear();
+	#ifndef NO_MMAP
+		if(base != nullptr)
+			munmap(const_cast<char*>(base), len);
+	#else
+		data.clear();
+	#endif
+	base = nullptr;
+	len = 0;
+}
+int							snapshot::		load() {
+	// the file stays mapped, a directory is rebuilt from it when first read
+	const fatxpar& par = fatx_context::get()->par;
+	string st;
+	if(!stamp(st))
+		return ENOTSUP;
+	FILE* f = fopen(file().data(), "rb");
+	if(f == nullptr)
+		return errno;
+	#ifndef NO_MMAP
+		struct stat fs;
+		void* m = MAP_FAILED;
+		if(fstat(fileno(f), &fs) == 0 && fs.st_size > 0)
+			m = mmap(nullptr, fs.st_size, PROT_READ, MAP_PRIVATE, fileno(f), 0);
+		fclose(f);
+		if(m == MAP_FAILED)
+			return EIO;
+		base = (const char*)m;
+		len = fs.st_size;
+	#else
+		char b[blksize];
+		for(size_t n; (n = fread(b, 1, blksize, f)) != 0; )
+			data.append(b, n);
+		fclose(f);
+		base = data.data();
+		len = data.size();
+	#endif
+	const char* p = base;
+	const char* e = base + len;
+	uint32_t id, clus, count;
+	uint64_t start, size;
+	if(len < strlen(snapid) || memcmp(p, snapid, strlen(snapid)) != 0) {
+		unmap();
+		return EINVAL;
+	}
+	p += strlen(snapid);
+	if(!snapget(p, e, id) || !snapget(p, e, clus) || !snapget(p, e, start) || !snapget(p, e, size) ||
+		id != par.par_id || clus != par.clus_size || start != (uint64_t)par.par_start || size != (uint64_t)par.par_size) {
+		unmap();
+		return EINVAL;
+	}
+	// anything written to the image since the last unmount drops the whole snapshot
+	if((size_t)(e - p) < st.size() || memcmp(p, st.data(), st.size()) != 0) {
+		unmap();
+		return ESTALE;
+	}
+	p += st.size();
+	if(!snapget(p, e, count)) {
+		unmap();
+		return EINVAL;
+	}
+	for(uint32_t n = 0; n < count; n++) {
+		const char* r = p;
+		uint32_t c, ne;
+		if(!snapget(p, e, c) || !snapget(p, e, ne) || (uint64_t)(e - p) < (uint64_t)ne * (sizeof(streamptr) + entry::ent_size)) {
+			unmap();
+			return EINVAL;
+		}
+		p += ne * (sizeof(streamptr) + entry::ent_size);
+		dirs[c] = make_pair(r - base, p - r);
+	}
+	#if defined DEBUG && defined DBG_INIT
+		dbglog((format("::SNAPSHOT %s: %d directories\n") % file() % dirs.size()).str())
+	#endif
+	return 0;
+}
+bool						snapshot::		take(const clusptr& c, dirents_t& res) {
+	// a record is used once, the stamp checked at load vouches for it
+	pair<size_t, size_t> r;
+	{
+		#ifndef NO_LOCK
+			scoped_lock<mutex> lock(access);
+		#endif
+		dirs_t::iterator it = dirs.find(c);
+		if(it == dirs.end())
+			return false;
+		r = it->second;
+		dirs.erase(it);
+	}
+	const char* p = base + r.first;
+	const char* e = p + r.second;
+	uint32_t cl = 0, ne = 0;
+	snapget(p, e, cl);
+	snapget(p, e, ne);
+	for(uint32_t i = 0; i < ne; i++) {
+		streamptr loc = 0;
+		snapget(p, e, loc);
+		res.push_back(make_pair(loc, p));
+		p += entry::ent_size;
+	}
+	return true;
+}
+void						snapshot::		keep(const entry* root) {
+	// directories read during this mount, taken from memory before the tree is freed
+	kept.clear();
+	count = 0;
+	set<clusptr> done;
+	list<const entry*> todo(1, root);
+	for(; !todo.empty(); todo.pop_front()) {
+		const entry& d = *todo.front();
+		if(!d.loaded() || d.cluster == EOC || d.cluster == FLK || done.count(d.cluster) != 0)
+			continue;
+		string ents;
+		uint32_t ne = 0;
+		for(const entry& i: d.childs) {
+			if(i.status != entry::valid || i.loc == 0)
+				continue;
+			snapput(ents, i.loc);
+			ents += i.record();
+			ne++;
+			if(i.flags.dir)
+				todo.push_back(&i);
+		}
+		snapput(kept, (uint32_t)d.cluster);
+		snapput(kept, ne);
+		kept += ents;
+		done.insert(d.cluster);
+		count++;
+	}
+	for(const dirs_t::value_type& i: dirs) {
+		if(done.count(i.first) != 0)
+			continue;
+		kept.append(base + i.second.first, i.second.second);
+		count++;
+	}
+	unmap();
+}
+int							snapshot::		save() {
+	// once the last write reached the image, so that its stamp is final
+	const fatxpar& par = fatx_context::get()->par;
+	string out(snapid);
+	snapput(out, par.par_id);
+	snapput(out, par.clus_size);
+	snapput(out, (uint64_t)par.par_start);
+	snapput(out, (uint64_t)par.par_size);
+	if(!stamp(out))
+		return ENOTSUP;
+	snapput(out, count);
+	out += kept;
+	kept.clear();
+	// written aside, then put in place of the old one
+	const string& dir = fatx_context::get()->mmi.snapdir;
+	for(size_t i = dir.find(sepdir, 1); ; i = dir.find(sepdir, i + 1)) {
+		mkdir(dir.substr(0, i).data(), S_IRWXU);
+		if(i == string::npos)
+			break;
+	}
+	const string name = file();
+	FILE* f = fopen((name + ".tmp").data(), "wb");
+	if(f == nullptr)
+		return errno;
+	bool ok = fwrite(out.data(), 1, out.size(), f) == out.size();
+	ok = fclose(f) == 0 && ok;
+	if(!ok || ::rename((name + ".tmp").data(), name.data()) != 0) {
+		remove((name + ".tmp").data());
+		return EIO;
+	}
 	#ifdef DEBUG
-		dbglog((format("TRUNCATE: %s\n") % path).str())
+		dbglog((format("--> snapshot saved in %s: %d directories\n") % name % count).str())
 	#endif
-	entry* f = fatx_context::get()->root->find(path);
-	if(f == nullptr || f->status == entry::invalid)
+	return 0;
+}
+#ifndef NO_FUSE
+static bool					fatx_live		(const entry* f) {
+	// a removed entry stays known by its inode and its handles, its clusters may already be reused
+	return f != nullptr && (f->status == entry::valid || (fatx_context::get()->mmi.recover && f->status != entry::invalid));
+}
+static int					fatx_stat		(const entry* f, struct stat* st) {
+	if(!fatx_live(f) || (f->flags.dir && f->cluster == 0))
+		return -ENOENT;
+	memset(st, 0, sizeof(struct stat));
+	st->st_dev		= fatx_context::get()->par.par_id;
+	st->st_mode		= f->flags() & (fatx_context::get()->mmi.mask | S_IFDIR | S_IFREG);
+	// a directory not read yet does not know its count of childs
+	st->st_nlink	= (f->flags.dir && !f->loaded()) ? 1 : f->entries() + 1;
+	st->st_size		= f->flags.dir ? f->entries() : f->size;
+	st->st_blksize	= fatx_context::get()->par.clus_size;
+	st->st_blocks	= clsarithm::siz2cls(f->size) * fatx_context::get()->par.clus_size / blksize;
+	st->st_atime	= f->access();
+	st->st_mtime	= f->update();
+	st->st_ctime	= f->creation();
+	st->st_uid		= fatx_context::get()->mmi.uid;
+	st->st_gid		= fatx_context::get()->mmi.gid;
+	return 0;
+}
+static int					fatx_getattr	(const char* path, struct stat* st) {
+	#ifdef DEBUG
+		dbglog((format("GETATTR: %s\n") % path).str())
+	#endif
+	entry* f = fatx_context::get()->dcache.find(path);
+	int res = fatx_stat(f, st);
+	#ifdef DEBUG
+		if(res == 0)
+			dbglog(f->print())
+	#endif
+	return res;
+}
+static int					fatx_setsize	(entry* f, off_t size) {
+	if(!fatx_live(f))
 		return -ENOENT;
 	if(!fatx_context::get()->mmi.writeable())
 		return -EROFS;
 	if(f->flags.ro)
 		return -EACCES;
-	return -f->resize(size);
+	return -f->truncate(size);
 }
-static int					fatx_open		(const char* path, struct fuse_file_info* fi) {
+static int					fatx_truncate	(const char* path, off_t size) {
 	#ifdef DEBUG
-		dbglog((format("OPEN: %s [%c]\n") % path % (fi->flags & (S_IWUSR | S_IWGRP | S_IWOTH) ? 'w' : 'r' )).str())
+		dbglog((format("TRUNCATE: %s\n") % path).str())
 	#endif
-	entry* f = fatx_context::get()->root->find(path);
-	if(f == nullptr || f->status == entry::invalid)
+	return fatx_setsize(fatx_context::get()->dcache.find(path), size);
+}
+static int					fatx_openent	(entry* f, struct fuse_file_info* fi) {
+	if(!fatx_live(f))
 		return -ENOENT;
 	if((fi->flags & (O_WRONLY | O_RDWR)) != 0 && !fatx_context::get()->mmi.writeable())
 		return -EROFS;
 	if((fi->flags & (O_WRONLY | O_RDWR)) != 0 && f->flags.ro)
 		return -EPERM;
 	f->open((fi->flags & (O_WRONLY | O_RDWR)) != 0);
-	fi->fh = (uint64_t)f;
+	fi->fh = (uint64_t)new handle(*f);
 	return 0;
 }
+static int					fatx_open		(const char* path, struct fuse_file_info* fi) {
+	#ifdef DEBUG
+		dbglog((format("OPEN: %s [%c]\n") % path % (fi->flags & (S_IWUSR | S_IWGRP | S_IWOTH) ? 'w' : 'r' )).str())
+	#endif
+	return fatx_openent(fatx_context::get()->dcache.find(path), fi);
+}
+static entry*				fatx_entry		(const char* path, struct fuse_file_info* fi) {
+	handle* h(fi != nullptr ? (handle*)(fi->fh) : nullptr);
+	return h != nullptr ? &h->ent : fatx_context::get()->dcache.find(path);
+}
+static int					fatx_sync		(entry* f, bool dirs) {
+	// directory clusters are written at close when asked, and always by fsync
+	fatx_context::get()->writeback.wait(f);
+	int res = f->flush();
+	if(res == 0 && (dirs || fatx_context::get()->mmi.dirsync == "close"))
+		res = fatx_context::get()->dclus.flush();
+	return -res;
+}
 static int					fatx_flush		(const char* path, struct fuse_file_info* fi) {
 	#ifdef DEBUG
 		dbglog((format("FLUSH: %s\n") % path).str())
 	#endif
-	entry* f((entry*)(fi->fh));
-	if(f == nullptr)
-		f = fatx_context::get()->root->find(path);
-	return -f->flush();
+	return fatx_sync(fatx_entry(path, fi), false);
 }
-static int					fatx_close		(const char* path, struct fuse_file_info* fi) {
+static int					fatx_fsync		(const char* path, int datasync, struct fuse_file_info* fi) {
 	#ifdef DEBUG
-		dbglog((format("CLOSE: %s\n") % path).str())
+		dbglog((format("FSYNC: %s\n") % path).str())
 	#endif
-	entry* f((entry*)(fi->fh));
-	if(f == nullptr)
-		f = fatx_context::get()->root->find(path);
+	(void) datasync;
+	return fatx_sync(fatx_entry(path, fi), true);
+}
+static int					fatx_release	(entry* f, struct fuse_file_info* fi) {
 	f->close((fi->flags & (O_WRONLY | O_RDWR)) != 0);
+	delete (handle*)(fi->fh);
 	fi->fh = (uint64_t)0;
 	return 0;
 }
+static int					fatx_close		(const char* path, struct fuse_file_info* fi) {
+	#ifdef DEBUG
+		dbglog((format("CLOSE: %s\n") % path).str())
+	#endif
+	return fatx_release(fatx_entry(path, fi), fi);
+}
 static int					fatx_read		(const char* path, char* buf, size_t size, off_t offset, struct fuse_file_info* fi) {
 	#ifdef DEBUG
 		dbglog((format("READ: %s\n") % path).str())
 	#endif
-	entry* f((entry*)(fi->fh));
-	if(f == nullptr)
-		f = fatx_context::get()->root->find(path);
-	return f->bufread(buf, offset, size);
+	handle* h((handle*)(fi->fh));
+	if(h == nullptr)
+		return fatx_context::get()->dcache.find(path)->bufread(buf, offset, size);
+	return h->read(buf, offset, size);
 }
 static int					fatx_write		(const char* path, const char* buf, size_t size, off_t offset, struct fuse_file_info* fi) {
 	#ifdef DEBUG
 		dbglog((format("WRITE: %s\n") % path).str())
 	#endif
-	entry* f((entry*)(fi->fh));
-	if(f == nullptr)
-		f = fatx_context::get()->root->find(path);
+	entry* f = fatx_entry(path, fi);
 	if(!fatx_context::get()->mmi.writeable())
 		return -EROFS;
 	if(f->flags.ro)
 		return -EACCES;
 	return f->bufwrite(buf, offset, size);
 }
-static int					fatx_chmod		(const char* path, mode_t mode) {
-	#ifdef DEBUG
-		dbglog((format("CHMOD: %s\n") % path).str())
-	#endif
-	entry* f = fatx_context::get()->root->find(path);
+static int					fatx_setmode	(entry* f, mode_t mode) {
 	if(f == nullptr || f->status == entry::invalid)
 		return -ENOENT;
 	if(!fatx_context::get()->mmi.writeable())
@@ -3430,13 +6091,19 @@ static int					fatx_chmod		(const char* path, mode_t mode) {
 	f->flags(mode);
 	return -f->save();
 }
+static int					fatx_chmod		(const char* path, mode_t mode) {
+	#ifdef DEBUG
+		dbglog((format("CHMOD: %s\n") % path).str())
+	#endif
+	return fatx_setmode(fatx_context::get()->dcache.find(path), mode);
+}
 static int					fatx_chown		(const char* path, uid_t uid, gid_t gid) {
 	(void) uid;
 	(void) gid;
 	#ifdef DEBUG
 		dbglog((format("CHOWN: %s\n") % path).str())
 	#endif
-	entry* f = fatx_context::get()->root->find(path);
+	entry* f = fatx_context::get()->dcache.find(path);
 	if(f == nullptr || f->status == entry::invalid)
 		return -ENOENT;
 	if(!fatx_context::get()->mmi.writeable())
@@ -3444,69 +6111,83 @@ static int					fatx_chown		(const char* path, uid_t uid, gid_t gid) {
 	// nothing done
 	return 0;
 }
-static int					fatx_readdir	(const char* path, void* buf, fuse_fill_dir_t ff, off_t offset, struct fuse_file_info* fi) {
-	#ifdef DEBUG
-		dbglog((format("READDIR: %s\n") % path).str())
-	#endif
-	(void)offset;
-	entry* f((entry*)(fi->fh));
-	if(f == nullptr)
-		f = fatx_context::get()->root->find(path);
+static int					fatx_listdir	(entry* f, off_t offset, const function<bool(const char*, const struct stat*, off_t)>& add) {
+	// stat data is taken from the entries, the offset of an entry is its rank in the directory + 2
 	struct stat st;
 	int res;
-	if((res = fatx_getattr(&f->path()[0], &st)) != 0)
-		return res;
-	ff(buf, ".", &st, 0);
-	if((res = fatx_getattr(&f->parent->path()[0], &st)) != 0)
-		return res;
-	ff(buf, "..", &st, 0);
-	for(const entry& i: f->childs) {
-		if(i.status == entry::valid || (fatx_context::get()->mmi.recover && i.status == entry::delwdata)) {
-			if((res = fatx_getattr(&i.path()[0], &st)) != 0)
-				return res;
-			if(ff(buf, i.name, &st, 0) != 0)
-				return -EBADF;
-			#ifdef DEBUG
-				dbglog((format(" %s\n") % i.path()).str())
-			#endif
-		}
+	if(offset < 1) {
+		if((res = fatx_stat(f, &st)) != 0)
+			return res;
+		if(!add(".", &st, 1))
+			return 0;
 	}
-	return 0;
+	if(offset < 2) {
+		if((res = fatx_stat(f->parent, &st)) != 0)
+			return res;
+		if(!add("..", &st, 2))
+			return 0;
+	}
+	res = 0;
+	f->list(max<off_t>(offset, 2) - 1, [&] (const entry& i, size_t n) -> bool {
+		if(i.status != entry::valid && !(fatx_context::get()->mmi.recover && i.status == entry::delwdata))
+			return true;
+		if((res = fatx_stat(&i, &st)) != 0)
+			return false;
+		#ifdef DEBUG
+			dbglog((format(" %s\n") % i.name).str())
+		#endif
+		return add(i.name, &st, n + 2);
+	});
+	return res;
 }
-static int					fatx_create		(const char* path, mode_t mode) {
+static int					fatx_readdir	(const char* path, void* buf, fuse_fill_dir_t ff, off_t offset, struct fuse_file_info* fi) {
 	#ifdef DEBUG
-		dbglog((format("CREATE: %s\n") % path).str())
+		dbglog((format("READDIR: %s\n") % path).str())
 	#endif
+	return fatx_listdir(fatx_entry(path, fi), offset, [&] (const char* n, const struct stat* st, off_t o) -> bool {
+		#ifdef HAVE_FUSE3
+			return ff(buf, n, st, o, (fuse_fill_dir_flags)0) == 0;
+		#else
+			return ff(buf, n, st, o) == 0;
+		#endif
+	});
+}
+static int					fatx_add		(entry* s, string name, mode_t mode, entry** res = nullptr) {
 	if(!fatx_context::get()->mmi.writeable())
 		return -EACCES;
-	string p(path);
-	size_t l = p.find_last_of(sepdir);
-	if(l == string::npos || l == p.length() - 1)
-		return -ENOENT;
 	if(fatx_context::get()->mmi.cutname)
-		p = p.substr(0, l + 1 + name_size);
+		name = name.substr(0, name_size);
 	else {
-		if((p.length() - (l + 1)) > name_size)
+		if(name.length() > name_size)
 			return -ENAMETOOLONG;
 	}
-	if(fatx_context::get()->root->find(path) != nullptr)
+	if(s == nullptr || s->status == entry::invalid || !s->flags.dir)
+		return -ENOENT;
+	if(s->find(name.c_str()) != nullptr)
 		return -EEXIST;
-	entry* n = new entry(p.substr(l + 1), 0, ((mode & S_IFREG) == 0));
+	entry* n = new entry(name, 0, ((mode & S_IFREG) == 0));
 	if(n->flags.dir && n->cluster == 0) {
 		delete n;
 		return -ENOSPC;
 	}
-	entry* s = fatx_context::get()->root->find(&(p.substr(0, l))[0]);
-	if(s == nullptr) {
-		delete n;
-		return -ENOENT;
-	}
-	int res = 0;
-	if((res = s->addtodir(n))) {
+	int err = 0;
+	if((err = s->addtodir(n))) {
 		delete n;
-		return -res;
+		return -err;
 	}
-	return fatx_chmod(path, mode);
+	if(res != nullptr)
+		*res = n;
+	return fatx_setmode(n, mode);
+}
+static int					fatx_create		(const char* path, mode_t mode) {
+	#ifdef DEBUG
+		dbglog((format("CREATE: %s\n") % path).str())
+	#endif
+	string p(path);
+	size_t l = p.find_last_of(sepdir);
+	if(l == string::npos || l == p.length() - 1)
+		return -ENOENT;
+	return fatx_add(fatx_context::get()->dcache.find(&(p.substr(0, l))[0]), p.substr(l + 1), mode);
 }
 static int					fatx_creope		(const char* path, mode_t mode, struct fuse_file_info* fi) {
 	#ifdef DEBUG
@@ -3517,11 +6198,7 @@ static int					fatx_creope		(const char* path, mode_t mode, struct fuse_file_inf
 		return res;
 	return fatx_open(path, fi);
 }
-static int					fatx_remove		(const char* path) {
-	#ifdef DEBUG
-		dbglog((format("REMOVE: %s\n") % path).str())
-	#endif
-	entry* f = fatx_context::get()->root->find(path);
+static int					fatx_del		(entry* f) {
 	if(f == nullptr || f->status == entry::invalid)
 		return -ENOENT;
 	if(!fatx_context::get()->mmi.writeable())
@@ -3530,17 +6207,20 @@ static int					fatx_remove		(const char* path) {
 		return -EACCES;
 	if(f == fatx_context::get()->root)
 		return -EBUSY;
-	if(f->flags.dir && f->childs.size() != 0)
+	f->load();
+	if(f->flags.dir && f->entries() != 0)
 		return -ENOTEMPTY;
 	assert(f->parent != nullptr);
 	f->parent->remfrdir(f);
 	return 0;
 }
-static int					fatx_rename		(const char* from, const char* to) {
+static int					fatx_remove		(const char* path) {
 	#ifdef DEBUG
-		dbglog((format("RENAME: %s to %s\n") % from % to).str())
+		dbglog((format("REMOVE: %s\n") % path).str())
 	#endif
-	entry* f = fatx_context::get()->root->find(from);
+	return fatx_del(fatx_context::get()->dcache.find(path));
+}
+static int					fatx_move		(entry* f, const char* to) {
 	if(f == nullptr || f->status == entry::invalid)
 		return -ENOENT;
 	if(!fatx_context::get()->mmi.writeable())
@@ -3549,26 +6229,30 @@ static int					fatx_rename		(const char* from, const char* to) {
 		return -EACCES;
 	return -f->rename(to);
 }
-static int					fatx_utimens	(const char* path, const struct timespec tv[2]) {
+static int					fatx_rename		(const char* from, const char* to) {
 	#ifdef DEBUG
-		dbglog((format("UTIMENS: %s\n") % path).str())
+		dbglog((format("RENAME: %s to %s\n") % from % to).str())
 	#endif
-	entry* f = fatx_context::get()->root->find(path);
+	return fatx_move(fatx_context::get()->dcache.find(from), to);
+}
+static int					fatx_settimes	(entry* f, time_t atime, time_t mtime) {
 	if(f == nullptr || f->status == entry::invalid)
 		return -ENOENT;
 	if(!fatx_context::get()->mmi.writeable())
 		return -EROFS;
 	if(f->flags.ro)
 		return -EACCES;
-	f->access(tv[0].tv_sec);
-	f->update(tv[1].tv_sec);
+	f->access(atime);
+	f->update(mtime);
 	return -f->save();
 }
-static int					fatx_statfs		(const char* path, struct statvfs* sfs) {
+static int					fatx_utimens	(const char* path, const struct timespec tv[2]) {
 	#ifdef DEBUG
-		dbglog((format("STATFS: %s\n") % path).str())
+		dbglog((format("UTIMENS: %s\n") % path).str())
 	#endif
-	(void)path;
+	return fatx_settimes(fatx_context::get()->dcache.find(path), tv[0].tv_sec, tv[1].tv_sec);
+}
+static int					fatx_fsinfo		(struct statvfs* sfs) {
 	sfs->f_bsize	= 1;									// blksize;
 	sfs->f_frsize	= 1;									// fatx_context::get()->par.clus_size / sfs->f_bsize;
 	sfs->f_blocks	= (fatx_context::get()->par.clus_fat - fatx_context::get()->par.root_clus) * fatx_context::get()->par.clus_size;
@@ -3609,15 +6293,37 @@ static int					fatx_statfs		(const char* path, struct statvfs* sfs) {
 	#endif
 	return 0;
 }
+static int					fatx_statfs		(const char* path, struct statvfs* sfs) {
+	#ifdef DEBUG
+		dbglog((format("STATFS: %s\n") % path).str())
+	#endif
+	(void)path;
+	return fatx_fsinfo(sfs);
+}
 static void*				fatx_init		(struct fuse_conn_info* fci) {
 	#ifdef DEBUG
 		dbglog("INIT\n")
 	#endif
-	fci->want = FUSE_CAP_BIG_WRITES | FUSE_CAP_DONT_MASK
-	#ifndef NO_SPLICE
-		| FUSE_CAP_SPLICE_READ | FUSE_CAP_SPLICE_WRITE | FUSE_CAP_SPLICE_MOVE
+	#ifdef HAVE_FUSE3
+		// large requests, writes gathered by the kernel cache and directories changed in parallel
+		fci->want |= fci->capable & (FUSE_CAP_DONT_MASK | FUSE_CAP_WRITEBACK_CACHE | FUSE_CAP_PARALLEL_DIROPS | FUSE_CAP_READDIRPLUS
+		#ifndef NO_SPLICE
+			| FUSE_CAP_SPLICE_READ | FUSE_CAP_SPLICE_WRITE | FUSE_CAP_SPLICE_MOVE
+		#endif
+		);
+		fci->max_write		= max_rw;
+		fci->max_readahead	= max_rw;
+	#else
+		fci->want = FUSE_CAP_BIG_WRITES | FUSE_CAP_DONT_MASK
+		#ifndef NO_SPLICE
+			| FUSE_CAP_SPLICE_READ | FUSE_CAP_SPLICE_WRITE | FUSE_CAP_SPLICE_MOVE
+		#endif
+		;
 	#endif
-	;
+	// threads are started once fuse has gone in background
+	fatx_context::get()->prefetch.start();
+	fatx_context::get()->writeback.start();
+	fatx_context::get()->dclus.start();
 	return 0;
 }
 static void					fatx_destroy	(void*) {
@@ -3626,30 +6332,47 @@ static void					fatx_destroy	(void*) {
 	#endif
 	fatx_context::get()->destroy();
 }
-#ifndef NO_SPLICE
-static int					fatx_read_buf	(const char* path, struct fuse_bufvec** bufp, size_t size, off_t offset, struct fuse_file_info* fi) {
-	#ifdef DEBUG
-		dbglog((format("READBUF: %s\n") % path).str())
-	#endif
-	entry* f((entry*)(fi->fh));
-	if(f == nullptr)
-		f = fatx_context::get()->root->find(path);
-	*bufp = f->getbufvec(offset, size);
-	return (*bufp) ? size : 0;
+#if !defined NO_SPLICE && !defined NO_FUSE_CALL
+static bool					fatx_spliced	(off_t offset, size_t size) {
+	// only large requests on whole clusters are worth going around the file cache
+	const filesize c = fatx_context::get()->par.clus_size;
+	return size >= splice_min && offset % c == 0 && size % c == 0;
+}
+#ifndef NO_WRITE
+static ssize_t				fatx_bufwrite	(entry& f, struct fuse_bufvec* buf, off_t offset) {
+	// small or unaligned writes are gathered by the file cache
+	const size_t size = fuse_buf_size(buf);
+	if(fatx_spliced(offset, size))
+		return f.bufsplice(buf, offset);
+	string mem(size, '\0');
+	struct fuse_bufvec dst;
+	dst.count		= 1;
+	dst.idx			= 0;
+	dst.off			= 0;
+	dst.buf[0].size	= size;
+	dst.buf[0].flags	= (fuse_buf_flags)0;
+	dst.buf[0].mem	= &mem[0];
+	dst.buf[0].fd	= -1;
+	dst.buf[0].pos	= 0;
+	ssize_t res = fuse_buf_copy(&dst, buf, (fuse_buf_copy_flags)0);
+	if(res <= 0)
+		return res;
+	return f.bufwrite(&mem[0], offset, res);
 }
+#endif
+#endif
+#ifndef NO_SPLICE
 static int					fatx_write_buf	(const char* path, struct fuse_bufvec* buf, off_t offset, struct fuse_file_info* fi) {
 	#ifdef DEBUG
 		dbglog((format("WRITEBUF: %s\n") % path).str())
 	#endif
-	entry* f((entry*)(fi->fh));
-	if(f == nullptr)
-		f = fatx_context::get()->root->find(path);
+	entry* f = fatx_entry(path, fi);
 	if(!fatx_context::get()->mmi.writeable())
 		return -EROFS;
 	if(f->flags.ro)
 		return -EACCES;
 	#if !defined NO_FUSE_CALL && !defined NO_WRITE
-		return fuse_buf_copy(f->getbufvec(offset, fuse_buf_size(buf)), buf, (fuse_buf_copy_flags)0);
+		return fatx_bufwrite(*f, buf, offset);
 	#else
 		(void) buf;
 		(void) offset;
@@ -3657,7 +6380,496 @@ static int					fatx_write_buf	(const char* path, struct fuse_bufvec* buf, off_t
 	#endif
 }
 #endif
+#ifdef HAVE_FUSE3
+static int					fatx_getattr3	(const char* path, struct stat* st, struct fuse_file_info* fi) {
+	if(fi == nullptr || fi->fh == 0)
+		return fatx_getattr(path, st);
+	return fatx_stat(fatx_entry(path, fi), st);
+}
+static int					fatx_truncate3	(const char* path, off_t size, struct fuse_file_info* fi) {
+	if(fi == nullptr || fi->fh == 0)
+		return fatx_truncate(path, size);
+	return fatx_setsize(fatx_entry(path, fi), size);
+}
+static int					fatx_chmod3		(const char* path, mode_t mode, struct fuse_file_info* fi) {
+	if(fi == nullptr || fi->fh == 0)
+		return fatx_chmod(path, mode);
+	return fatx_setmode(fatx_entry(path, fi), mode);
+}
+static int					fatx_chown3		(const char* path, uid_t uid, gid_t gid, struct fuse_file_info*) {
+	return fatx_chown(path, uid, gid);
+}
+static int					fatx_utimens3	(const char* path, const struct timespec tv[2], struct fuse_file_info* fi) {
+	if(fi == nullptr || fi->fh == 0)
+		return fatx_utimens(path, tv);
+	return fatx_settimes(fatx_entry(path, fi), tv[0].tv_sec, tv[1].tv_sec);
+}
+static int					fatx_rename3	(const char* from, const char* to, unsigned int flags) {
+	// exchange and no replace are not supported
+	if(flags != 0)
+		return -EINVAL;
+	return fatx_rename(from, to);
+}
+static int					fatx_readdir3	(const char* path, void* buf, fuse_fill_dir_t ff, off_t offset, struct fuse_file_info* fi, enum fuse_readdir_flags) {
+	return fatx_readdir(path, buf, ff, offset, fi);
+}
+static void*				fatx_init3		(struct fuse_conn_info* fci, struct fuse_config*) {
+	return fatx_init(fci);
+}
+static ssize_t				fatx_copy3		(const char* from, struct fuse_file_info* fi, off_t offset, const char* to, struct fuse_file_info* fo, off_t offset_out, size_t size, int flags) {
+	#ifdef DEBUG
+		dbglog((format("COPY: %s to %s\n") % from % to).str())
+	#endif
+	(void) flags;
+	entry* f = fatx_entry(from, fi);
+	entry* t = fatx_entry(to, fo);
+	if(f == nullptr || t == nullptr)
+		return -ENOENT;
+	if(!fatx_context::get()->mmi.writeable())
+		return -EROFS;
+	if(t->flags.ro)
+		return -EACCES;
+	return t->copy(*f, offset, offset_out, size);
+}
+#endif
 static struct fuse_operations				fatx_ops;
+#ifndef NO_FUSE_CALL
+static const double			ll_timeout		= 1.0;					/// seconds the kernel keeps attributes and names when not told of changes
+static double				fatx_ll_timeout	() {
+	// long only when changes are notified to the kernel
+	return fatx_context::get()->notify.active() ? fatx_context::get()->mmi.fuse_timeout : ll_timeout;
+}
+static entry*				fatx_ll_node	(fuse_ino_t ino) {
+	// the inode of a removed entry is kept until forgotten, but leads nowhere
+	entry* f = fatx_context::get()->nodes.find(ino);
+	return fatx_live(f) ? f : nullptr;
+}
+static entry*				fatx_ll_child	(fuse_ino_t parent, const char* name) {
+	entry* d = fatx_ll_node(parent);
+	if(d == nullptr || !d->flags.dir)
+		return nullptr;
+	return d->find(name);
+}
+static int					fatx_ll_param	(entry* f, struct fuse_entry_param* e, bool lookup = true) {
+	// a reply of an entry counts as a lookup
+	memset(e, 0, sizeof(struct fuse_entry_param));
+	if(int res = fatx_stat(f, &e->attr))
+		return res;
+	e->ino			= fatx_context::get()->nodes.get(f, lookup);
+	e->attr.st_ino	= e->ino;
+	e->attr_timeout	= fatx_ll_timeout();
+	e->entry_timeout	= fatx_ll_timeout();
+	return 0;
+}
+static void					fatx_ll_entry	(fuse_req_t req, entry* f, int res) {
+	struct fuse_entry_param e;
+	if(res == 0)
+		res = fatx_ll_param(f, &e);
+	if(res == 0)
+		fuse_reply_entry(req, &e);
+	else
+		fuse_reply_err(req, -res);
+}
+static void					fatx_ll_attr	(fuse_req_t req, fuse_ino_t ino, entry* f, int res) {
+	struct stat st;
+	if(res == 0)
+		res = fatx_stat(f, &st);
+	if(res == 0) {
+		st.st_ino = ino;
+		fuse_reply_attr(req, &st, fatx_ll_timeout());
+	}
+	else
+		fuse_reply_err(req, -res);
+}
+static void					fatx_ll_init	(void*, struct fuse_conn_info* fci) {
+	fatx_init(fci);
+	fatx_context::get()->notify.start();
+}
+static void					fatx_ll_destroy	(void*) {
+	fatx_destroy(nullptr);
+}
+static void					fatx_ll_lookup	(fuse_req_t req, fuse_ino_t parent, const char* name) {
+	#ifdef DEBUG
+		dbglog((format("LOOKUP: %d %s\n") % parent % name).str())
+	#endif
+	entry* f = fatx_ll_child(parent, name);
+	struct fuse_entry_param e;
+	int res = fatx_live(f) ? fatx_ll_param(f, &e) : -ENOENT;
+	if(res != 0) {
+		fuse_reply_err(req, -res);
+		return;
+	}
+	// the kernel keeps the name it asked for, which may differ in case from the one of the entry
+	if(strcmp(name, f->name) != 0)
+		fatx_context::get()->nodes.alias(e.ino, name);
+	fuse_reply_entry(req, &e);
+}
+static void					fatx_ll_forget	(fuse_req_t req, fuse_ino_t ino, unsigned long nlookup) {
+	fatx_context::get()->nodes.forget(ino, nlookup);
+	fuse_reply_none(req);
+}
+static void					fatx_ll_forgets	(fuse_req_t req, size_t count, struct fuse_forget_data* forgets) {
+	for(size_t i = 0; i < count; i++)
+		fatx_context::get()->nodes.forget(forgets[i].ino, forgets[i].nlookup);
+	fuse_reply_none(req);
+}
+static void					fatx_ll_getattr	(fuse_req_t req, fuse_ino_t ino, struct fuse_file_info*) {
+	#ifdef DEBUG
+		dbglog((format("GETATTR: %d\n") % ino).str())
+	#endif
+	fatx_ll_attr(req, ino, fatx_ll_node(ino), 0);
+}
+static void					fatx_ll_setattr	(fuse_req_t req, fuse_ino_t ino, struct stat* attr, int to_set, struct fuse_file_info* fi) {
+	#ifdef DEBUG
+		dbglog((format("SETATTR: %d 0x%X\n") % ino % to_set).str())
+	#endif
+	handle* h(fi != nullptr ? (handle*)(fi->fh) : nullptr);
+	entry* f = h != nullptr ? &h->ent : fatx_ll_node(ino);
+	int res = 0;
+	if(f == nullptr)
+		res = -ENOENT;
+	else if(!fatx_live(f))
+		res = -ESTALE;
+	else if((to_set & (FUSE_SET_ATTR_UID | FUSE_SET_ATTR_GID)) != 0 && !fatx_context::get()->mmi.writeable())
+		res = -EROFS;
+	if(res == 0 && (to_set & FUSE_SET_ATTR_MODE) != 0)
+		res = fatx_setmode(f, attr->st_mode);
+	if(res == 0 && (to_set & FUSE_SET_ATTR_SIZE) != 0)
+		res = fatx_setsize(f, attr->st_size);
+	if(res == 0 && (to_set & (FUSE_SET_ATTR_ATIME | FUSE_SET_ATTR_MTIME)) != 0) {
+		time_t a = f->access();
+		time_t m = f->update();
+		if((to_set & FUSE_SET_ATTR_ATIME) != 0)
+			a = (to_set & FUSE_SET_ATTR_ATIME_NOW) != 0 ? time(0) : attr->st_atime;
+		if((to_set & FUSE_SET_ATTR_MTIME) != 0)
+			m = (to_set & FUSE_SET_ATTR_MTIME_NOW) != 0 ? time(0) : attr->st_mtime;
+		res = fatx_settimes(f, a, m);
+	}
+	fatx_ll_attr(req, ino, f, res);
+}
+static void					fatx_ll_mkdir	(fuse_req_t req, fuse_ino_t parent, const char* name, mode_t mode) {
+	#ifdef DEBUG
+		dbglog((format("MKDIR: %d %s\n") % parent % name).str())
+	#endif
+	entry* f = nullptr;
+	int res = fatx_add(fatx_ll_node(parent), name, mode & ~S_IFMT, &f);
+	fatx_ll_entry(req, f, res);
+}
+static void					fatx_ll_remove	(fuse_req_t req, fuse_ino_t parent, const char* name) {
+	#ifdef DEBUG
+		dbglog((format("REMOVE: %d %s\n") % parent % name).str())
+	#endif
+	fuse_reply_err(req, -fatx_del(fatx_ll_child(parent, name)));
+}
+static void					fatx_ll_rename	(fuse_req_t req, fuse_ino_t parent, const char* name, fuse_ino_t newparent, const char* newname) {
+	#ifdef DEBUG
+		dbglog((format("RENAME: %d %s to %d %s\n") % parent % name % newparent % newname).str())
+	#endif
+	entry* d = fatx_ll_node(newparent);
+	if(d == nullptr) {
+		fuse_reply_err(req, ENOENT);
+		return;
+	}
+	fuse_reply_err(req, -fatx_move(fatx_ll_child(parent, name), (d->path() + newname).c_str()));
+}
+#ifdef HAVE_FUSE3
+static void					fatx_ll_rename3	(fuse_req_t req, fuse_ino_t parent, const char* name, fuse_ino_t newparent, const char* newname, unsigned int flags) {
+	// exchange and no replace are not supported
+	if(flags != 0)
+		fuse_reply_err(req, EINVAL);
+	else
+		fatx_ll_rename(req, parent, name, newparent, newname);
+}
+#endif
+static void					fatx_ll_open	(fuse_req_t req, fuse_ino_t ino, struct fuse_file_info* fi) {
+	#ifdef DEBUG
+		dbglog((format("OPEN: %d\n") % ino).str())
+	#endif
+	if(int res = fatx_openent(fatx_ll_node(ino), fi))
+		fuse_reply_err(req, -res);
+	else
+		fuse_reply_open(req, fi);
+}
+static void					fatx_ll_read	(fuse_req_t req, fuse_ino_t ino, size_t size, off_t offset, struct fuse_file_info* fi) {
+	#ifdef DEBUG
+		dbglog((format("READ: %d\n") % ino).str())
+	#endif
+	(void) ino;
+	handle* h((handle*)(fi->fh));
+	if(!fatx_live(&h->ent)) {
+		fuse_reply_err(req, ESTALE);
+		return;
+	}
+	#ifndef NO_SPLICE
+		if(fatx_spliced(offset, size)) {
+			h->ent.bufreply(req, offset, size);
+			return;
+		}
+	#endif
+	string buf(size, '\0');
+	fuse_reply_buf(req, &buf[0], h->read(&buf[0], offset, size));
+}
+static void					fatx_ll_write	(fuse_req_t req, fuse_ino_t ino, const char* buf, size_t size, off_t offset, struct fuse_file_info* fi) {
+	#ifdef DEBUG
+		dbglog((format("WRITE: %d\n") % ino).str())
+	#endif
+	(void) ino;
+	entry& f = ((handle*)(fi->fh))->ent;
+	if(!fatx_context::get()->mmi.writeable())
+		fuse_reply_err(req, EROFS);
+	else if(!fatx_live(&f))
+		fuse_reply_err(req, ESTALE);
+	else if(f.flags.ro)
+		fuse_reply_err(req, EACCES);
+	else
+		fuse_reply_write(req, f.bufwrite(buf, offset, size));
+}
+#ifndef NO_SPLICE
+static void					fatx_ll_wrbuf	(fuse_req_t req, fuse_ino_t ino, struct fuse_bufvec* buf, off_t offset, struct fuse_file_info* fi) {
+	#ifdef DEBUG
+		dbglog((format("WRITEBUF: %d\n") % ino).str())
+	#endif
+	(void) ino;
+	entry& f = ((handle*)(fi->fh))->ent;
+	ssize_t res = 0;
+	if(!fatx_context::get()->mmi.writeable())
+		res = -EROFS;
+	else if(!fatx_live(&f))
+		res = -ESTALE;
+	else if(f.flags.ro)
+		res = -EACCES;
+	#ifndef NO_WRITE
+	else
+		res = fatx_bufwrite(f, buf, offset);
+	#endif
+	if(res < 0)
+		fuse_reply_err(req, -res);
+	else
+		fuse_reply_write(req, res);
+}
+#endif
+static void					fatx_ll_flush	(fuse_req_t req, fuse_ino_t ino, struct fuse_file_info* fi) {
+	#ifdef DEBUG
+		dbglog((format("FLUSH: %d\n") % ino).str())
+	#endif
+	(void) ino;
+	fuse_reply_err(req, -fatx_sync(&((handle*)(fi->fh))->ent, false));
+}
+static void					fatx_ll_fsync	(fuse_req_t req, fuse_ino_t ino, int datasync, struct fuse_file_info* fi) {
+	#ifdef DEBUG
+		dbglog((format("FSYNC: %d\n") % ino).str())
+	#endif
+	(void) ino;
+	(void) datasync;
+	fuse_reply_err(req, -fatx_sync(&((handle*)(fi->fh))->ent, true));
+}
+static void					fatx_ll_release	(fuse_req_t req, fuse_ino_t ino, struct fuse_file_info* fi) {
+	#ifdef DEBUG
+		dbglog((format("CLOSE: %d\n") % ino).str())
+	#endif
+	(void) ino;
+	fuse_reply_err(req, -fatx_release(&((handle*)(fi->fh))->ent, fi));
+}
+static void					fatx_ll_list	(fuse_req_t req, fuse_ino_t ino, size_t size, off_t offset, struct fuse_file_info* fi, bool plus) {
+	// as many entries as the kernel buffer holds are sent in one reply, with the offsets of fatx_listdir,
+	// with readdirplus each entry but . and .. counts as a lookup
+	entry* f = &((handle*)(fi->fh))->ent;
+	string buf(size, '\0');
+	size_t pos = 0;
+	int res = 0;
+	auto add = [&] (const char* name, entry* e, off_t next) -> bool {
+		struct fuse_entry_param p;
+		const bool lookup = plus && next > 2;
+		if((res = fatx_ll_param(e, &p, lookup)) != 0)
+			return false;
+		if(next == 1)
+			p.ino = p.attr.st_ino = ino;
+		size_t l;
+		#ifdef HAVE_FUSE3
+			if(plus)
+				l = fuse_add_direntry_plus(req, &buf[pos], size - pos, name, &p, next);
+			else
+		#endif
+				l = fuse_add_direntry(req, &buf[pos], size - pos, name, &p.attr, next);
+		if(l > size - pos) {
+			if(lookup)
+				fatx_context::get()->nodes.forget(p.ino, 1);
+			return false;
+		}
+		pos += l;
+		return true;
+	};
+	bool more = true;
+	if(offset < 1)
+		more = add(".", f, 1);
+	if(offset < 2 && more)
+		more = add("..", f->parent, 2);
+	if(more) {
+		f->list(max<off_t>(offset, 2) - 1, [&] (const entry& i, size_t n) -> bool {
+			if(i.status != entry::valid && !(fatx_context::get()->mmi.recover && i.status == entry::delwdata))
+				return true;
+			return add(i.name, const_cast<entry*>(&i), n + 2);
+		});
+	}
+	if(res != 0 && pos == 0)
+		fuse_reply_err(req, -res);
+	else
+		fuse_reply_buf(req, buf.data(), pos);
+}
+static void					fatx_ll_readdir	(fuse_req_t req, fuse_ino_t ino, size_t size, off_t offset, struct fuse_file_info* fi) {
+	#ifdef DEBUG
+		dbglog((format("READDIR: %d\n") % ino).str())
+	#endif
+	fatx_ll_list(req, ino, size, offset, fi, false);
+}
+#ifdef HAVE_FUSE3
+static void					fatx_ll_copy	(fuse_req_t req, fuse_ino_t ino, off_t offset, struct fuse_file_info* fi, fuse_ino_t ino_out, off_t offset_out, struct fuse_file_info* fo, size_t size, int flags) {
+	#ifdef DEBUG
+		dbglog((format("COPY: %d to %d\n") % ino % ino_out).str())
+	#endif
+	(void) ino;
+	(void) ino_out;
+	(void) flags;
+	entry& f = ((handle*)(fi->fh))->ent;
+	entry& t = ((handle*)(fo->fh))->ent;
+	ssize_t res = 0;
+	if(!fatx_context::get()->mmi.writeable())
+		res = -EROFS;
+	else if(t.flags.ro)
+		res = -EACCES;
+	else
+		res = t.copy(f, offset, offset_out, size);
+	if(res < 0)
+		fuse_reply_err(req, -res);
+	else
+		fuse_reply_write(req, res);
+}
+static void					fatx_ll_rdplus	(fuse_req_t req, fuse_ino_t ino, size_t size, off_t offset, struct fuse_file_info* fi) {
+	#ifdef DEBUG
+		dbglog((format("READDIRPLUS: %d\n") % ino).str())
+	#endif
+	fatx_ll_list(req, ino, size, offset, fi, true);
+}
+#endif
+static void					fatx_ll_fsyncdir(fuse_req_t req, fuse_ino_t ino, int datasync, struct fuse_file_info* fi) {
+	(void) ino;
+	(void) datasync;
+	(void) fi;
+	fuse_reply_err(req, -fatx_context::get()->dclus.flush());
+}
+static void					fatx_ll_statfs	(fuse_req_t req, fuse_ino_t ino) {
+	#ifdef DEBUG
+		dbglog((format("STATFS: %d\n") % ino).str())
+	#endif
+	(void) ino;
+	struct statvfs sfs;
+	memset(&sfs, 0, sizeof(struct statvfs));
+	fatx_fsinfo(&sfs);
+	fuse_reply_statfs(req, &sfs);
+}
+static void					fatx_ll_create	(fuse_req_t req, fuse_ino_t parent, const char* name, mode_t mode, struct fuse_file_info* fi) {
+	#ifdef DEBUG
+		dbglog((format("CREOPE: %d %s\n") % parent % name).str())
+	#endif
+	entry* f = nullptr;
+	struct fuse_entry_param e;
+	int res = fatx_add(fatx_ll_node(parent), name, mode | S_IFREG, &f);
+	if(res == 0)
+		res = fatx_openent(f, fi);
+	if(res == 0 && (res = fatx_ll_param(f, &e)) != 0)
+		fatx_release(f, fi);
+	if(res == 0)
+		fuse_reply_create(req, &e, fi);
+	else
+		fuse_reply_err(req, -res);
+}
+static struct fuse_lowlevel_ops				fatx_llops;
+static int					fatx_ll_main	(int argc, char* argv[]) {
+	// same command line as fuse_main, served by a session of the low level interface
+	struct fuse_args args = FUSE_ARGS_INIT(argc, argv);
+	int err = 1;
+	memset(&fatx_llops, 0, sizeof(fatx_llops));
+	fatx_llops.init			= fatx_ll_init;
+	fatx_llops.destroy		= fatx_ll_destroy;
+	fatx_llops.lookup		= fatx_ll_lookup;
+	fatx_llops.forget		= fatx_ll_forget;
+	fatx_llops.forget_multi	= fatx_ll_forgets;
+	fatx_llops.getattr		= fatx_ll_getattr;
+	fatx_llops.setattr		= fatx_ll_setattr;
+	fatx_llops.mkdir		= fatx_ll_mkdir;
+	fatx_llops.unlink		= fatx_ll_remove;
+	fatx_llops.rmdir		= fatx_ll_remove;
+	#ifdef HAVE_FUSE3
+		fatx_llops.rename		= fatx_ll_rename3;
+		fatx_llops.readdirplus	= fatx_ll_rdplus;
+		fatx_llops.copy_file_range	= fatx_ll_copy;
+	#else
+		fatx_llops.rename		= fatx_ll_rename;
+	#endif
+	fatx_llops.open			= fatx_ll_open;
+	fatx_llops.read			= fatx_ll_read;
+	fatx_llops.write		= fatx_ll_write;
+	fatx_llops.flush		= fatx_ll_flush;
+	fatx_llops.release		= fatx_ll_release;
+	fatx_llops.fsync		= fatx_ll_fsync;
+	fatx_llops.opendir		= fatx_ll_open;
+	fatx_llops.readdir		= fatx_ll_readdir;
+	fatx_llops.releasedir	= fatx_ll_release;
+	fatx_llops.fsyncdir		= fatx_ll_fsyncdir;
+	fatx_llops.statfs		= fatx_ll_statfs;
+	fatx_llops.create		= fatx_ll_create;
+	#ifndef NO_SPLICE
+		fatx_llops.write_buf	= fatx_ll_wrbuf;
+	#endif
+	#ifdef HAVE_FUSE3
+		struct fuse_cmdline_opts opts;
+		memset(&opts, 0, sizeof(opts));
+		if(fuse_parse_cmdline(&args, &opts) == 0 && opts.mountpoint != nullptr) {
+			struct fuse_session* se = fuse_session_new(&args, &fatx_llops, sizeof(fatx_llops), nullptr);
+			fatx_context::get()->notify.attach(se);
+			if(se != nullptr) {
+				if(fuse_set_signal_handlers(se) == 0) {
+					if(fuse_session_mount(se, opts.mountpoint) == 0) {
+						if(fuse_daemonize(opts.foreground) == 0) {
+							struct fuse_loop_config cfg;
+							cfg.clone_fd			= opts.clone_fd;
+							cfg.max_idle_threads	= opts.max_idle_threads;
+							err = opts.singlethread ? fuse_session_loop(se) : fuse_session_loop_mt(se, &cfg);
+						}
+						fuse_session_unmount(se);
+					}
+					fuse_remove_signal_handlers(se);
+				}
+				fuse_session_destroy(se);
+			}
+		}
+		free(opts.mountpoint);
+	#else
+		struct fuse_chan* ch = nullptr;
+		char* mountpoint = nullptr;
+		int multithreaded = 0;
+		int foreground = 0;
+		if(fuse_parse_cmdline(&args, &mountpoint, &multithreaded, &foreground) != -1 && (ch = fuse_mount(mountpoint, &args)) != nullptr) {
+			struct fuse_session* se = fuse_lowlevel_new(&args, &fatx_llops, sizeof(fatx_llops), nullptr);
+			fatx_context::get()->notify.attach(ch);
+			if(se != nullptr) {
+				if(fuse_set_signal_handlers(se) != -1) {
+					fuse_session_add_chan(se, ch);
+					if(fuse_daemonize(foreground) != -1)
+						err = multithreaded ? fuse_session_loop_mt(se) : fuse_session_loop(se);
+					fuse_remove_signal_handlers(se);
+					fuse_session_remove_chan(ch);
+				}
+				fuse_session_destroy(se);
+			}
+			fuse_unmount(mountpoint, ch);
+		}
+		free(mountpoint);
+	#endif
+	fuse_opt_free_args(&args);
+	return err;
+}
+#endif
 #endif
 
 #ifdef ENABLE_XBOX
@@ -3727,6 +6939,15 @@ int							main			(int argc, char* argv[]) {
 			fuse_argv[fuse_argc++] = &(*(new string("-o")))[0];
 			fuse_argv[fuse_argc++] = &mmi.fuse_option[0];
 		}
+		#ifdef HAVE_FUSE3
+			// each worker thread reads requests from its own copy of the device
+			fuse_argv[fuse_argc++] = &(*(new string("-o")))[0];
+			fuse_argv[fuse_argc++] = &(*(new string("clone_fd")))[0];
+			if(mmi.fuse_threads != 0) {
+				fuse_argv[fuse_argc++] = &(*(new string("-o")))[0];
+				fuse_argv[fuse_argc++] = &(*(new string((format("max_idle_threads=%d") % mmi.fuse_threads).str())))[0];
+			}
+		#endif
 		for(const string& i: mmi.unkopt) {
 			if(fuse_argc < (max_fuse_args - 1))
 				fuse_argv[fuse_argc++] = &(*(new string(i)))[0];
@@ -3740,29 +6961,43 @@ int							main			(int argc, char* argv[]) {
 			fatx_context::get()->fat->gapcheck();
 		#ifndef NO_FUSE
 			memset(&fatx_ops, 0, sizeof(fatx_ops));
-			fatx_ops.getattr		= fatx_getattr;
-			fatx_ops.utimens		= fatx_utimens;
-			fatx_ops.chmod			= fatx_chmod;
-			fatx_ops.chown			= fatx_chown;
 			fatx_ops.create			= fatx_creope;
 			fatx_ops.open			= fatx_open;
 			fatx_ops.read			= fatx_read;
 			fatx_ops.write			= fatx_write;
 			fatx_ops.flush			= fatx_flush;
+			fatx_ops.fsync			= fatx_fsync;
+			fatx_ops.fsyncdir		= fatx_fsync;
 			fatx_ops.release		= fatx_close;
-			fatx_ops.truncate		= fatx_truncate;
 			fatx_ops.unlink			= fatx_remove;
 			fatx_ops.mkdir			= fatx_create;
 			fatx_ops.opendir		= fatx_open;
-			fatx_ops.readdir		= fatx_readdir;
 			fatx_ops.releasedir		= fatx_close;
 			fatx_ops.rmdir			= fatx_remove;
-			fatx_ops.rename			= fatx_rename;
 			fatx_ops.statfs			= fatx_statfs;
-			fatx_ops.init			= fatx_init;
 			fatx_ops.destroy		= fatx_destroy;
+			#ifdef HAVE_FUSE3
+				fatx_ops.copy_file_range	= fatx_copy3;
+				fatx_ops.getattr		= fatx_getattr3;
+				fatx_ops.utimens		= fatx_utimens3;
+				fatx_ops.chmod			= fatx_chmod3;
+				fatx_ops.chown			= fatx_chown3;
+				fatx_ops.truncate		= fatx_truncate3;
+				fatx_ops.readdir		= fatx_readdir3;
+				fatx_ops.rename			= fatx_rename3;
+				fatx_ops.init			= fatx_init3;
+			#else
+				fatx_ops.getattr		= fatx_getattr;
+				fatx_ops.utimens		= fatx_utimens;
+				fatx_ops.chmod			= fatx_chmod;
+				fatx_ops.chown			= fatx_chown;
+				fatx_ops.truncate		= fatx_truncate;
+				fatx_ops.readdir		= fatx_readdir;
+				fatx_ops.rename			= fatx_rename;
+				fatx_ops.init			= fatx_init;
+			#endif
 			#ifndef NO_SPLICE
-				fatx_ops.read_buf		= fatx_read_buf;
+				// reads stay on the file cache, libfuse splices after the lock of the file is released
 				fatx_ops.write_buf		= fatx_write_buf;
 			#endif
 			#ifdef DEBUG
@@ -3775,7 +7010,10 @@ int							main			(int argc, char* argv[]) {
 			#ifdef NO_FUSE_CALL
 				(void) fuse_argv;
 			#else
-				err = fuse_main(fuse_argc, fuse_argv, &fatx_ops, nullptr);
+				if(mmi.fuse_lowlevel)
+					err = fatx_ll_main(fuse_argc, fuse_argv);
+				else
+					err = fuse_main(fuse_argc, fuse_argv, &fatx_ops, nullptr);
 			#endif
 			#ifdef DEBUG
 				dbglog((format("Fuse returned: %d\n") % err).str())
@@ -3784,7 +7022,8 @@ int							main			(int argc, char* argv[]) {
 			(void) fuse_argv;
 		#endif
 	}
-	bool answ;
+	bool answ = false;
+	bool copied = true;
 	if(mmi.prog == frontend::mkfs) {
 		console::write((format("Are you sure you want to erase all data in %s ?") % mmi.input).str());
 		if((answ = mmi.getanswer(false))) {
@@ -3822,6 +7061,24 @@ int							main			(int argc, char* argv[]) {
 		else
 			console::write("Unable to change volume name.\n");
 	}
+	if(mmi.prog == frontend::mkfs && answ && !mmi.populate.empty()) {
+		console::write((format("Copying %s") % (mmi.populate == "-" ? string("standard input") : mmi.populate)).str());
+		if(mmi.populate == "-")
+			copied = tarball::extract(fatx_context::get()->root, cin) == 0;
+		else {
+			importer i;
+			copied = i.populate(fatx_context::get()->root, mmi.populate) == 0;
+		}
+	}
+	if(mmi.prog == frontend::label && !mmi.tardir.empty()) {
+		entry* d = fatx_context::get()->root->find(mmi.tardir.data());
+		if(d == nullptr || !d->flags.dir) {
+			console::write((format("Can't find directory %s.\n") % mmi.tardir).str(), true);
+			copied = false;
+		}
+		else
+			copied = tarball::create(d, cout) == 0;
+	}
 	if(mmi.prog == frontend::fsck) {
 		if(fatx_context::get()->par.par_label.empty())
 			console::write("Warning: volume has no name.\n");
@@ -3853,5 +7110,5 @@ int							main			(int argc, char* argv[]) {
 	#ifdef DEBUG
 		dbglog((format("<= ENDC: %s\n") % mmi.name()).str())
 	#endif
-	return err;
+	return copied ? err : code_operr;
 }
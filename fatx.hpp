@@ -44,6 +44,8 @@
  *	-D NO_CACHE		to disable FAT cache
  *	-D NO_FUSE_CALL	to disable calls to fuse library
  *	-D NO_SPLICE	to disable splice calls by fuse
+ *	-D NO_PIO		to disable positioned reads and writes (pread/pwrite) on device
+ *	-D NO_MMAP		to read tree snapshots instead of mapping them in memory
  *	-D NO_OPTION	to disable option parsing
  *	-D ENABLE_XBOX	to enable configuration for XBOX xbe
  *
@@ -64,6 +66,8 @@
 	#define NO_IO
 	#define NO_FCNTL
 	#define NO_TIME
+	#define NO_PIO
+	#define NO_MMAP
 	#ifdef DEBUG
 		#undef DEBUG
 	#endif
@@ -90,9 +94,17 @@
 #ifndef NO_LOCK
 	#include <pthread.h>
 #endif
+#ifndef NO_MMAP
+	#include <sys/mman.h>
+#endif
 #ifndef NO_FUSE
-	#define FUSE_USE_VERSION 29
+	#ifdef HAVE_FUSE3
+		#define FUSE_USE_VERSION 32
+	#else
+		#define FUSE_USE_VERSION 29
+	#endif
 	#include <fuse.h>
+	#include <fuse_lowlevel.h>
 #endif
 #ifndef NO_OPTION
 	#include <boost/program_options.hpp>
@@ -109,10 +121,12 @@
 #include <memory>
 #include <list>
 #include <map>
+#include <unordered_map>
 #include <set>
 #include <cassert>
 #include <algorithm>
 #include <bitset>
+#include <atomic>
 
 #include <string.h>
 #include <math.h>
@@ -120,6 +134,8 @@
 #include <errno.h>
 #include <sys/types.h>
 #include <sys/stat.h>
+#include <dirent.h>
+#include <utime.h>
 
 #include <boost/cstdint.hpp>
 #include <boost/integer.hpp>
@@ -157,11 +173,29 @@ class						dskmap;			/// device file allocation table management
 class						memmap;			/// memory file allocation table used to handle deleted entries
 class						entry;			/// file or directory entry
 class						vareas;			/// vector of areas in fat
+class						chainidx;		/// sparse jump index on a fat chain
 class						buffer;			/// file buffer
+class						pagecache;		/// file cache of buffers
+class						bufpool;		/// process wide pool of file cache pages
+class						handle;			/// opened file
+class						prefetcher;		/// background read ahead of sequentially read files
+class						flusher;		/// background write behind of file caches
+class						dirclusters;	/// directory clusters changed by entries
+class						dentries;		/// cache of resolved paths
+class						inodes;			/// inode numbers of the low level fuse interface
+class						notifier;		/// invalidations of kernel caches
+class						snapshot;		/// tree of directories kept between mounts
+class						streamer;		/// copy of files by chunks
+class						importer;		/// copy of a host tree in a new volume
+class						exporter;		/// copy of a tree of the volume on the host
+class						tarball;		/// tar streams of the volume
 
 typedef std::shared_ptr<vareas>			ptr_vareas;
+typedef std::shared_ptr<chainidx>		ptr_chainidx;
 typedef std::unique_ptr<buffer>			ptr_buffer;
+typedef std::unique_ptr<pagecache>		ptr_pagecache;
 typedef std::unique_ptr<entry>			ptr_entry;
+typedef map<clusptr, string>			dirdata_t;		/// directory clusters read ahead of their scan
 
 static const size_t			blksize			= 512;					/// standard block size
 static const clusptr		EOC				= 0xFFFFFFFF;			/// fat: end of chain
@@ -171,7 +205,23 @@ static const unsigned char	name_size		= 0x2A;					/// maximum size of entry name
 static const unsigned char	deleted_size	= 0xE5;					/// name size used in entry to mark entry as deleted
 static const size_t			slab			= name_size * 2 + 2;	/// maximum size of label name file
 static const int			max_fuse_args	= 20;					/// maximum number of unrecognized arguments passed to fuse
-static const unsigned int	max_buf			= 1*1024*1024;			/// buffer maximum size
+static const unsigned int	max_rw			= 1024*1024;			/// largest read and write requests asked to fuse 3
+static const unsigned int	splice_min		= 128*1024;				/// smallest cluster aligned request spliced, others go through the file cache
+static const unsigned int	cp_chunk		= 1024*1024;			/// bytes moved at once by copies inside the device
+static const unsigned int	pg_size			= 64*1024;				/// file cache page minimum size
+static const unsigned int	def_cache		= 64;					/// default size of file caches in MB
+static const unsigned int	pool_batch		= 8;					/// pages reclaimed at once from cold file caches
+static const unsigned int	ra_span			= 500;					/// milliseconds of sequential reading prefetched ahead
+static const unsigned int	wb_threads		= 2;					/// threads writing full pages of file caches behind
+static const unsigned int	dirty_div		= 2;					/// cache pool divider for dirty pages maximum size
+static const unsigned int	jmp_step		= 64;					/// clusters between two checkpoints of a chain index
+static const unsigned int	max_dentries	= 65536;				/// resolved paths kept in cache
+static const unsigned int	scan_threads	= 4;					/// threads reading directory clusters during a full scan
+static const unsigned int	cp_threads		= 4;					/// files copied together by bulk copies
+static const unsigned int	scan_batch		= 1024;					/// directory clusters read together during a full scan
+static const unsigned int	dir_delay		= 5;					/// seconds before changed directory clusters are written
+static const unsigned int	max_dirclus		= 256;					/// directory clusters kept in memory
+static const unsigned int	def_ll_timeout	= 3600;					/// default seconds the kernel keeps attributes and names of the low level interface
 static const unsigned int	max_cache_div	= 1000;					/// fat size divider for cache maximum size
 static const unsigned int	nb_cache_div	= 10;					/// cache size divider for nuber of read ahead operations
 static const unsigned int	timeout			= 60;					/// timeout in seconds
@@ -184,6 +234,7 @@ static const int			code_usage		= 1<<4;					/// usage error code
 extern const char*			sepdir;									/// using unix directories
 extern const char*			fsid;									/// filesystem id
 extern const char*			fidx;									/// file used for label name
+extern const char*			snapid;									/// tree snapshot file id
 extern const char*			def_landf;								/// default directory for lost & founds
 extern const char*			def_fpre;								/// default file prefix for lost & founds
 extern const char*			def_label;								/// default label name
@@ -334,6 +385,7 @@ private:
 	bool							gentimedlock(char, function<bool()>);
 	void							genunlockupgradableandlock(function<void()>);
 	void							genunlockandlockupgradable(function<void()>);
+	void							genunlockandlocksharable(function<void()>);
 public:
 			mutex(const string n = "???") : nam(n), cpt(0) {
 	}
@@ -358,6 +410,15 @@ public:
 		#endif
 		);
 	}
+	bool	try_lock() {
+		return gentimedlock('X',
+		#ifndef NO_LOCK
+			bind(&interprocess_upgradable_mutex::try_lock, this)
+		#else
+			0
+		#endif
+		);
+	}
 	bool	timed_lock(const posix_time::ptime& p) {
 		#ifdef NO_LOCK
 			(void) p;
@@ -448,6 +509,15 @@ public:
 		#endif
 		);
 	}
+	void	unlock_and_lock_sharable() {
+		genunlockandlocksharable(
+		#ifndef NO_LOCK
+			bind(&interprocess_upgradable_mutex::unlock_and_lock_sharable, this)
+		#else
+			0
+		#endif
+		);
+	}
 	void	name(const string n) {
 		nam = n;
 	}
@@ -479,6 +549,7 @@ public:
 						read_cache(const fread_t&, const fwrite_t&, size_t, size_t);
 						~read_cache();
 	void				clear();
+	void				forget(const key_type&, const key_type&);
 	value_type			operator () (const key_type&);
 	int					operator () (const key_type&, const value_type&);
 	void				operator () ();
@@ -529,7 +600,7 @@ public:
 		).str();
 	}
 	#endif
-	char*						write(char buf[1]) {
+	char*						write(char buf[1]) const {
 		buf[0] =
 			ro	? (1 << 0) : 0 |
 			hid	? (1 << 1) : 0 |
@@ -543,7 +614,7 @@ public:
 		return buf;
 	}
 	#ifndef NO_FUSE
-	mode_t						operator () () {
+	mode_t						operator () () const {
 		return
 			S_IRUSR | S_IXUSR | S_IRGRP | S_IXGRP | S_IROTH | S_IXOTH |
 			(!ro ? (S_IWUSR | S_IWGRP | S_IWOTH) : 0) |
@@ -566,6 +637,7 @@ public:
 	unsigned int				hour;
 	unsigned int				min;
 	unsigned int				sec;
+	mutable std::atomic<time_t>	stamp;			/// time converted once, 0 until asked
 	typedef uint64_t			date_t;
 	date() :
 		year	(1980),
@@ -573,7 +645,8 @@ public:
 		day		(1),
 		hour	(0),
 		min		(0),
-		sec		(0) {
+		sec		(0),
+		stamp	(0) {
 	}
 	date(const unsigned char buf[4]) :
 		year	((buf[0] >> 1) + 1980),
@@ -581,7 +654,27 @@ public:
 		day		((buf[1] & 0x1F) + 1),
 		hour	(buf[2] >> 3),
 		min		(((buf[2] & 0x07) << 3) | ((buf[3] & 0xE0) >> 5)),
-		sec		(buf[3] & 0x1F) {
+		sec		(buf[3] & 0x1F),
+		stamp	(0) {
+	}
+	date(const date& d) :
+		year	(d.year),
+		month	(d.month),
+		day		(d.day),
+		hour	(d.hour),
+		min		(d.min),
+		sec		(d.sec),
+		stamp	(d.stamp.load()) {
+	}
+	date&						operator = (const date& d) {
+		year	= d.year;
+		month	= d.month;
+		day		= d.day;
+		hour	= d.hour;
+		min		= d.min;
+		sec		= d.sec;
+		stamp	= d.stamp.load();
+		return *this;
 	}
 	#ifdef DEBUG
 	string						print() const {
@@ -591,7 +684,7 @@ public:
 		).str();
 	}
 	#endif
-	unsigned char*				write(unsigned char buf[4]) {
+	unsigned char*				write(unsigned char buf[4]) const {
 		buf[0] = (((year - 1980) & 0x7F) << 1)	| (((month - 1) & 0x08) >> 3);
 		buf[1] = (((month - 1) & 0x07) << 5)	| ((day - 1) & 0x1F);
 		buf[2] = ((hour & 0x1F) << 3) | ((min & 0x38) >> 3);
@@ -608,15 +701,22 @@ public:
 			((date_t)(sec			& 0xFF)		<< 0)
 		;
 	}
-	time_t						operator () () {
+	time_t						operator () () const {
+		// mktime is slow and locks the time zone, so it runs once per change
+		time_t t = stamp;
+		if(t != 0)
+			return t;
 		struct tm st;
+		memset(&st, 0, sizeof(st));
 		st.tm_year	= year - 1900;
 		st.tm_mon	= month - 1;
 		st.tm_mday	= day;
 		st.tm_hour	= hour;
 		st.tm_min	= min;
 		st.tm_sec	= sec;
-		return mktime(&st);
+		st.tm_isdst	= -1;
+		stamp = t = mktime(&st);
+		return t;
 	}
 	void						operator () (const time_t& t) {
 		struct tm* st(localtime(&t));
@@ -627,6 +727,7 @@ public:
 			hour	= st->tm_hour;
 			min		= st->tm_min;
 			sec		= st->tm_sec;
+			stamp	= t;
 		}
 	}
 };
@@ -656,20 +757,113 @@ public:
 	void					add(clusptr);
 	string					print() const;
 };
+/// Sparse jump index on a FAT chain
+///
+class						chainidx {
+private:
+	map<clusptr, clusptr>	jumps;			/// rank of cluster in chain (file offset >> clus_pow) -> cluster
+	mutex					access;
+public:
+							chainidx() : access("chain") {
+	}
+	clusptr					seek(clusptr&, const clusptr&);
+	void					mark(const clusptr&, const clusptr&);
+	void					cut(const clusptr&);
+	void					clear();
+};
 // Data buffers
 //
 class 						buffer : public string {
 public:
 	bool			touched;
 	streamptr		offset;
+	std::atomic<uint64_t>	stamp;	/// also refreshed by readers sharing the lock
+	uint64_t		gen;			/// changes at each write
 					buffer(const streamptr = 0, const streamptr = 0);
 					~buffer();
-	void			enlarge(const streamptr);
 	void			operator () (size_t);
 };
+// File cache of cluster aligned pages, least recently used page is evicted
+//
+class						pagecache : boost::noncopyable {
+private:
+	typedef map<filesize, ptr_buffer>	pages_t;
+
+	entry&			ent;
+	mutex&			lock;			/// lock of the entry, taken by the pool to steal clean pages
+	pages_t			pages;
+	std::atomic<uint64_t>	tick;
+	std::atomic<uint64_t>	seen;	/// last use in pool clock
+	bool			behind;			/// pages written behind since entry was saved
+	const size_t	pgsiz;
+
+	buffer*			get(const filesize&);
+	void			mark(buffer&, bool);
+	void			release(pages_t::iterator);
+	buffer*			make(const filesize&, const filesize&, const filesize&);
+	int				evict(const filesize&, const filesize&);
+	int				load(const filesize&, const filesize&);
+	int				store(pages_t::iterator, pages_t::iterator);
+	bool			resident(filesize, filesize) const;
+	bool			bypass(filesize, filesize) const;
+	int				direct(char*, bool, filesize, filesize);
+public:
+					pagecache(entry&, mutex&);
+					~pagecache();
+	int				read(char*, filesize, filesize);
+	int				peek(char*, filesize, filesize);
+	int				write(const char*, filesize, filesize, filesize);
+	int				fetch(filesize, filesize);
+	int				expose(filesize, filesize, bool);
+	int				flush();
+	void			cut(const filesize&);
+	bool			dirty() const;
+	size_t			shed(vector<ptr_buffer>&, size_t);
+	bool			snapshot(const filesize&, string&, uint64_t&);
+	void			clean(const filesize&, const uint64_t&);
+	uint64_t		age() const {
+		return seen;
+	}
+};
+// Pages of all file caches, shared within a memory budget
+//
+class						bufpool : boost::noncopyable {
+private:
+	size_t					budget;
+	size_t					pgsiz;
+	size_t					total;			/// memory held by pages in caches or spare
+	vector<ptr_buffer>		spare;
+	set<pagecache*>			caches;
+	std::atomic<uint64_t>	clock;
+	std::atomic<size_t>		dirt;			/// dirty pages
+	mutex					access;
+	void					reclaim(pagecache&);
+public:
+							bufpool();
+							~bufpool();
+	int						setup();
+	size_t					page() const {
+		return pgsiz;
+	}
+	uint64_t				tick() {
+		return ++clock;
+	}
+	void					dirty(int n) {
+		dirt += n;
+	}
+	bool					overdirty() const {
+		return dirt * pgsiz > budget / dirty_div;
+	}
+	size_t					share();
+	ptr_buffer				take(pagecache&);
+	void					give(ptr_buffer);
+	void					enter(pagecache*);
+	void					leave(pagecache*);
+};
 
 class						console {
 public:
+	static bool				piped;			/// data on the standard output, messages go to the error output
 	static void				write(const string, bool = false);
 	static pair<bool, bool>	read();
 };
@@ -698,6 +892,9 @@ public:
 	bool						fuse_debug;
 	bool						fuse_foregrd;
 	bool						fuse_singlethr;
+	bool						fuse_lowlevel;
+	unsigned int				fuse_threads;
+	unsigned int				fuse_timeout;
 	bool						nofat;
 	bool						cutname;
 	int							argc;
@@ -720,8 +917,13 @@ public:
 	bool						allyes;
 	streamptr					offset;
 	streamptr					size;
+	streamptr					cache_size;
+	string						snapdir;
+	string						dirsync;
 	string						input;
 	string						script;
+	string						populate;
+	string						tardir;
 
 								frontend(int, const char* const * const);
 								~frontend();
@@ -762,6 +964,9 @@ public:
 	#endif
 	string						read(const streamptr&, const size_t	= blksize);
 	int							write(const streamptr&, const string&);
+	int							read(const streamptr&, char*, const size_t);
+	int							write(const streamptr&, const char*, const size_t);
+	int							copy(const streamptr&, const streamptr&, const size_t);
 	string						address(const streamptr&) const;
 	void						devlog(bool, const streamptr&, const string&) const;
 	string						print(const streamptr&, const size_t& = blksize, const size_t& = 32);
@@ -885,8 +1090,10 @@ public:
 	void						erase();
 	void						gapcheck();
 	vareas						getareas(const clusptr&, lbdarea_t = 0);
+	vareas						getareas(const clusptr&, chainidx&, filesize, filesize);
 	virtual clusptr				read(const clusptr&);
 	int							write(const clusptr&, const clusptr&);
+	int							link(const clusptr&, const clusptr&);
 	vareas						alloc(const clusptr&, const clusptr& = 0);
 	void						free(const clusptr&);
 	int							resize(ptr_vareas, const clusptr&);	/* changed */
@@ -941,10 +1148,24 @@ private:
 	int							cptacc;
 	enum {none, yes, no}		writeopened;
 	mutex						authb;
-	mutex						authw;
-	void						opendir();
+	mutable mutex				authw;
+	unordered_multimap<size_t, entry*>	names;	/// childs by hash of their case folded name
+	std::atomic<bool>			ready;			/// childs read from disk
+	bool						slotted;		/// end mark and deleted entries of the directory known
+	streamptr					eod;			/// end mark of the directory, 0 when none
+	size_t						seq;			/// rank in the directory, kept when other entries go
+	size_t						seqs;			/// last rank given to a child
+	set<streamptr>				holes;			/// deleted entries before the end mark
+	static bool					lazy();
+	void						opendir(dirdata_t* = nullptr);
+	void						scan();
 	void						closedir();
+	void						findslots();
 	int							write();
+	static size_t				hashname(const char*, size_t);
+	void						index(entry*, bool);
+	void						adopt(entry*);
+	entry*						child(const char*, size_t);
 public:
 	enum						status_t {
 		valid,
@@ -974,8 +1195,9 @@ public:
 	streamptr					loc;
 	ptr_vector<entry>			childs;
 	entry*						parent;
-	ptr_buffer					entbuf;
+	ptr_pagecache				pages;
 	ptr_vareas					areas;
+	ptr_chainidx				jumps;
 
 								entry();
 								entry(const streamptr&, const char [ent_size] = 0);
@@ -983,9 +1205,16 @@ public:
 								~entry();
 	string						print() const;
 	string						path() const;
+	string						record() const;
 	int							addtodir(entry*);
 	void						remfrdir(entry*, bool = true);
 	entry*						find(const char*);
+	void						list(size_t, const function<bool(const entry&, size_t)>&);
+	void						load();
+	bool						loaded() const {
+		return ready;
+	}
+	size_t						entries() const;
 	void						touch(bool = true, bool = true, bool = true);
 	int							save();
 	int							rename(const char*);
@@ -994,9 +1223,14 @@ public:
 	void						guess();
 	bool						analyse(const pass_t&, const string = string(""));
 	int							resize(const filesize);
+	int							truncate(const filesize);
+	vareas						extents(filesize, filesize) const;
 	int							data(char*, bool, filesize, filesize);
 	size_t						bufread(char*, filesize, filesize);
 	size_t						bufwrite(const char*, filesize, filesize);
+	ssize_t						copy(entry&, filesize, filesize, filesize);
+	void						prefetch(filesize, filesize);
+	int							writebehind(filesize);
 	int							flush(bool = true);
 	void						open(bool w);
 	void						close(bool w);
@@ -1004,9 +1238,310 @@ public:
 		return writeopened != no;
 	}
 	bool						operator == (const entry&) const;
-#ifndef NO_FUSE
-	struct fuse_bufvec*			getbufvec(filesize, filesize);
+#if !defined NO_FUSE && !defined NO_SPLICE && !defined NO_FUSE_CALL
+	int							bufreply(fuse_req_t, filesize, filesize);
+	ssize_t						bufsplice(struct fuse_bufvec*, filesize);
+#endif
+};
+/// Opened file, with the pattern of its reads
+///
+class						handle : boost::noncopyable {
+private:
+	filesize					next;			/// offset of a sequential read
+	filesize					ahead;			/// end of data asked to the prefetcher
+	double						rate;			/// bytes read per second
+	posix_time::ptime			last;
+	mutex						access;			/// reads of a handle come from several fuse threads
+public:
+	entry&						ent;
+
+								handle(entry&);
+	size_t						read(char*, filesize, filesize);
+};
+/// Copy by chunks through two buffers, the next chunk is read by a thread of the copy while the previous one is written
+///
+class						streamer : boost::noncopyable {
+public:
+	typedef function<int(char*, filesize, size_t)>	io_t;	/// read or write of a chunk at an offset, returns an error code
+private:
+	const io_t&					in;
+	const filesize				total;
+	const size_t				chunks;
+	string						bufs[2];		/// chunk c is in bufs[c & 1]
+	size_t						reads;			/// chunks read
+	size_t						writes;			/// chunks written
+	int							res;			/// error of the reader
+	bool						cancel;			/// the reader stops, the copy is over
+#ifndef NO_LOCK
+	pthread_mutex_t				access;
+	pthread_cond_t				wake;
+	static void*				run(void*);
+#endif
+								streamer(filesize, const io_t&);
+								~streamer();
+	size_t						size(size_t) const;
+public:
+	static int					copy(filesize, const io_t&, const io_t&);
+};
+/// Copy of a host tree in a new volume: the tree is created first, then the chains of the files
+/// are allocated one after the other, and their data copied by several threads in the order of the clusters
+///
+class						importer : boost::noncopyable {
+private:
+	struct						job {
+		entry*					ent;
+		string					host;
+		filesize				size;
+		time_t					atime;
+		time_t					mtime;
+	};
+	vector<job>					files;
+	size_t						dirs;
+	std::atomic<size_t>			next;
+	std::atomic<int>			err;
+	int							tree(entry*, const string&);
+	static void*				run(void*);
+public:
+								importer() : dirs(0), next(0), err(0) {
+	}
+	int							populate(entry*, const string&);
+	static streamer::io_t		clusters(entry*);
+};
+/// Copy of a tree of the volume on the host: the directories are made first,
+/// then the files are read by several threads in the order of their clusters
+///
+class						exporter : boost::noncopyable {
+private:
+	struct						job {
+		entry*					ent;
+		string					host;
+	};
+	vector<job>					files;
+	vector<job>					dirs;
+	std::atomic<size_t>			next;
+	std::atomic<int>			err;
+	int							tree(entry*, const string&);
+	static void*				run(void*);
+	static void					stamp(const job&);
+public:
+	static bool					safe(const entry&);
+								exporter() : next(0), err(0) {
+	}
+	int							extract(entry*, const string&);
+	size_t						count() const {
+		return files.size();
+	}
+};
+/// Tar streams in ustar format: a tree of the volume written to a stream,
+/// or a stream read in a new volume, each file written in a chain allocated at once
+///
+class						tarball : boost::noncopyable {
+private:
+	static const size_t			blk = 512;		/// size of headers, and unit of data
+	static const size_t			meta = 4*1024*1024;	/// largest data of a long name or pax header
+	static void					octal(char*, size_t, uint64_t);
+	static uint64_t				number(const char*, size_t);
+	static int					head(ostream&, const string&, const entry&);
+	static entry*				make(entry*, const string&, bool, filesize);
+public:
+	static int					create(entry*, ostream&);
+	static int					extract(entry*, istream&);
+};
+/// Thread loading file caches ahead of sequential reads
+///
+class						prefetcher : boost::noncopyable {
+private:
+	struct						job {
+		entry*					ent;
+		filesize				offset;
+		filesize				size;
+	};
+	list<job>					jobs;
+	entry*						busy;
+	bool						running;
+#ifndef NO_LOCK
+	pthread_t					worker;
+	pthread_mutex_t				access;
+	pthread_cond_t				wake;
+	pthread_cond_t				idle;
+	static void*				run(void*);
 #endif
+public:
+								prefetcher();
+								~prefetcher();
+	void						start();
+	void						stop();
+	void						push(entry*, filesize, filesize);
+	void						cancel(entry*);
+};
+/// Threads writing full dirty pages of file caches
+///
+class						flusher : boost::noncopyable {
+private:
+	struct						job {
+		entry*					ent;
+		filesize				page;
+	};
+	list<job>					jobs;
+	multiset<entry*>			busy;			/// entries of jobs being processed
+	multiset<entry*>			io;				/// entries of jobs writing to the device
+	bool						running;
+#ifndef NO_LOCK
+	pthread_t					workers[wb_threads];
+	unsigned int				started;		/// workers actually created
+	pthread_mutex_t				access;
+	pthread_cond_t				wake;
+	pthread_cond_t				idle;
+	static void*				run(void*);
+#endif
+	bool						pending(entry*) const;
+public:
+								flusher();
+								~flusher();
+	void						start();
+	void						stop();
+	void						push(entry*, filesize);
+	void						begin(entry*);
+	void						end(entry*);
+	void						wait(entry*);
+	void						drain(entry*);
+	void						cancel(entry*);
+	void						throttle();
+};
+/// Directory clusters with the changes of their entries, written back as whole clusters
+///
+class						dirclusters : boost::noncopyable {
+private:
+	struct						cluster {
+		string					data;
+		bool					dirty;
+	};
+	typedef map<clusptr, cluster>	clusters_t;
+
+	clusters_t					clusters;
+	bool						running;
+#ifndef NO_LOCK
+	pthread_t					worker;
+	pthread_mutex_t				access;
+	pthread_cond_t				wake;
+	static void*				run(void*);
+#endif
+	int							writeback();
+public:
+								dirclusters();
+								~dirclusters();
+	void						start();
+	void						stop();
+	bool						delayed() const;
+	string						read(const clusptr&);
+	int							write(const streamptr&, const string&);
+	int							release(const clusptr&);
+	int							sync(const clusptr&);
+	int							flush();
+};
+/// Paths resolved by fuse calls, with paths found not to exist
+///
+class						dentries : boost::noncopyable {
+private:
+	typedef pair<string, string>	key_t;		/// case folded path, path
+	struct						dentry_t {
+		entry*					ent;			/// null when none
+		list<key_t>::iterator	age;			/// place in the order of insertion
+		std::atomic<bool>		used;			/// found since passed by the eviction
+	};
+	typedef map<key_t, dentry_t>	paths_t;
+
+	paths_t						paths;
+	list<key_t>					ages;			/// oldest first, a path found again gets a second chance
+	std::atomic<uint64_t>		gen;			/// changes at each invalidation
+	mutex						access;
+	static string				fold(const string&);
+	void						evict();
+public:
+								dentries() : gen(0), access("dentries") {
+	}
+	entry*						find(const char*);
+	void						forget(entry*);
+	void						clear();
+};
+/// Inode numbers given to the kernel by the low level fuse interface, with their count of lookups
+///
+class						inodes : boost::noncopyable {
+private:
+	typedef pair<entry*, uint64_t>	node_t;		/// entry, lookups not forgotten yet
+
+	unordered_map<uint64_t, node_t>	nodes;
+	unordered_map<entry*, uint64_t>	numbers;
+	unordered_map<uint64_t, set<string>>	cases;	/// other cases of the name the kernel looked the entry up by
+	uint64_t					next;			/// numbers given when the one of the entry location is taken
+	mutex						access;
+public:
+								inodes() : next(1ULL << 62), access("inodes") {
+	}
+	uint64_t					get(entry*, bool = true);
+	uint64_t					known(const entry*);
+	entry*						find(uint64_t);
+	void						alias(uint64_t, const char*);
+	set<string>					unalias(const entry*);
+	void						forget(uint64_t, uint64_t);
+	void						clear();
+};
+/// Invalidations of the kernel caches for entries changed by the low level interface, sent by a thread
+/// as the kernel may hold locks on them while waiting for the reply of the request that changed them
+///
+class						notifier : boost::noncopyable {
+private:
+	set<uint64_t>				attrs;			/// inodes whose attributes changed
+	list<pair<uint64_t, string>>	names;		/// names gone, in every case known by the kernel, with the inode of their directory
+	void*						target;			/// channel (fuse 2) or session (fuse 3) of the mount
+	bool						running;
+#ifndef NO_LOCK
+	pthread_t					worker;
+	pthread_mutex_t				access;
+	pthread_cond_t				wake;
+	static void*				run(void*);
+#endif
+public:
+								notifier();
+								~notifier();
+	void						attach(void*);
+	void						start();
+	void						stop();
+	bool						active() const {
+		return running;
+	}
+	void						attr(const entry*);
+	void						name(const entry*, const entry*);
+};
+/// Directories read at last mount, saved at unmount and taken back when the image was not written since
+///
+class						snapshot : boost::noncopyable {
+public:
+	typedef vector<pair<streamptr, const char*> >	dirents_t;	/// location and raw content of entries
+private:
+	typedef map<clusptr, pair<size_t, size_t> >	dirs_t;		/// first cluster -> offset and size of record
+	dirs_t						dirs;
+	const char*					base;
+	size_t						len;
+#ifdef NO_MMAP
+	string						data;
+#endif
+	string						kept;
+	uint32_t					count;
+	mutex						access;
+	string						file() const;
+	void						unmap();
+	static bool					stamp(string&);
+public:
+								snapshot() : base(nullptr), len(0), count(0), access("snapshot") {
+	}
+								~snapshot() {
+		unmap();
+	}
+	int							load();
+	void						keep(const entry*);
+	int							save();
+	bool						take(const clusptr&, dirents_t&);
 };
 class 						fatx_context {
 private:
@@ -1015,6 +1550,14 @@ public:
 	frontend&				mmi;
 	device					dev;
 	fatxpar					par;
+	bufpool					pool;
+	prefetcher				prefetch;
+	flusher					writeback;
+	dirclusters				dclus;
+	dentries				dcache;
+	inodes					nodes;
+	notifier				notify;
+	snapshot				snap;
 	dskmap*					fat;
 	entry*					root;
 
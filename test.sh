@@ -341,6 +341,218 @@ fuse12() {
 	fi
 	remfuse
 }
+fuse13() {
+	echo Fuse: splice throughput:
+	prefuse
+	mkdir mnt/fuse13
+	size=64
+	dd if=/dev/urandom of=fuse13.src bs=1M count=$size >/dev/null 2>&1
+	t1=$(date +%s%N)
+	dd if=fuse13.src of=mnt/fuse13/big bs=1M >/dev/null 2>&1
+	t2=$(date +%s%N)
+	dd if=fuse13.src of=mnt/fuse13/odd bs=100001 >/dev/null 2>&1
+	remfuse
+	prefuse
+	# small and unaligned requests go through the file cache, large aligned ones are spliced
+	dd if=fuse13.src of=fuse13.dst bs=4099 skip=7 count=300 >/dev/null 2>&1
+	dd if=mnt/fuse13/odd of=fuse13.part bs=4099 skip=7 count=300 >/dev/null 2>&1
+	cmp -s fuse13.dst fuse13.part || {
+		echo "### Test KO", unaligned reads are different
+		rm -f fuse13.src fuse13.dst fuse13.part
+		kilfuse
+		exit 1
+	}
+	t3=$(date +%s%N)
+	dd if=mnt/fuse13/big of=fuse13.dst bs=1M >/dev/null 2>&1
+	t4=$(date +%s%N)
+	cmp -s fuse13.src fuse13.dst && cmp -s fuse13.src mnt/fuse13/odd || {
+		echo "### Test KO", files are different
+		rm -f fuse13.src fuse13.dst fuse13.part
+		kilfuse
+		exit 1
+	}
+	# a truncated file no longer reads the clusters it gave back
+	truncate -s 1000000 mnt/fuse13/big
+	dd if=fuse13.src of=mnt/fuse13/other bs=1M count=8 >/dev/null 2>&1
+	head -c 1000000 fuse13.src | cmp -s - mnt/fuse13/big || {
+		echo "### Test KO", truncated file is different
+		rm -f fuse13.src fuse13.dst fuse13.part
+		kilfuse
+		exit 1
+	}
+	rm -f fuse13.src fuse13.dst fuse13.part
+	echo "*** Test OK", write = $[$size * 1000000000 / ($t2 - $t1 + 1)] MB/s, read = $[$size * 1000000000 / ($t4 - $t3 + 1)] MB/s
+	remfuse
+}
+fuse14() {
+	echo Fuse: tree snapshot:
+	rm -rf fuse14.snap
+	prefuse "--snapshot fuse14.snap"
+	mkdir -p mnt/fuse14/a/b mnt/fuse14/c
+	echo TEST >mnt/fuse14/a/b/f
+	remfuse
+	[ -n "$(ls fuse14.snap)" ] || {
+		echo "### Test KO", no snapshot saved
+		exit 1
+	}
+	./fatx --as label $DSK -l XBOX --do "mv, /fuse14/a/b/f, /fuse14/c/g" >/dev/null 2>&1
+	prefuse "--snapshot fuse14.snap"
+	ls -R mnt/fuse14 >fuse14.ls
+	[ ! -e mnt/fuse14/a/b/f ] && [ "$(cat mnt/fuse14/c/g)" == TEST ] || {
+		echo "### Test KO", snapshot not checked against the disk
+		cat fuse14.ls
+		rm -rf fuse14.snap fuse14.ls
+		kilfuse
+		exit 1
+	}
+	rm -rf fuse14.snap fuse14.ls
+	echo "*** Test OK"
+	remfuse
+}
+fuse15() {
+	echo Fuse: low level interface:
+	prefuse --lowlevel
+	mkdir -p mnt/fuse15/a mnt/fuse15/b mnt/fuse15/big
+	dd if=/dev/urandom of=fuse15.src bs=1k count=300 >/dev/null 2>&1
+	cp fuse15.src mnt/fuse15/a/f
+	mv mnt/fuse15/a/f mnt/fuse15/b/g
+	rmdir mnt/fuse15/a
+	# far more entries than a single readdir reply holds
+	for ((i = 0; i < 1000; i++)); do
+		touch mnt/fuse15/big/file_with_a_rather_long_name_$i
+	done
+	remfuse
+	prefuse --lowlevel
+	for ((i = 0; i < 1000; i++)); do
+		echo file_with_a_rather_long_name_$i
+	done | sort >fuse15.lst
+	[ ! -e mnt/fuse15/a ] && cmp -s fuse15.src mnt/fuse15/b/g && ls mnt/fuse15/big | sort | cmp -s - fuse15.lst || {
+		echo "### Test KO", tree is different
+		rm -f fuse15.src fuse15.lst
+		kilfuse
+		exit 1
+	}
+	rm -rf mnt/fuse15/big
+	[ ! -e mnt/fuse15/big ] || {
+		echo "### Test KO", directory not removed
+		rm -f fuse15.src fuse15.lst
+		kilfuse
+		exit 1
+	}
+	rm -f fuse15.src fuse15.lst
+	echo "*** Test OK"
+	remfuse
+}
+fuse16() {
+	echo Fuse: directory read in several replies:
+	echo LIST >tlist1
+	./fatx --as label $DSK -l XBOX --do "mkdir, /fuse16" >/dev/null 2>&1
+	# by runs of 500, a single argument of the whole script would be too long
+	for ((i = 0; i < 3000; i += 500)); do
+		cmd=""
+		for ((j = i; j < i + 500; j++)); do
+			cmd="$cmd rcp, tlist1, /fuse16/entry_with_a_long_name_for_replies_$j;"
+		done
+		./fatx --as label $DSK -l XBOX --do "$cmd" >/dev/null 2>&1
+	done
+	for ((i = 0; i < 3000; i++)); do
+		echo entry_with_a_long_name_for_replies_$i
+	done | sort >tlist.lst
+	prefuse
+	# each getdents call of ls goes on from the offset the previous one stopped at
+	ls -f mnt/fuse16 | grep -v '^\.\.\?$' | sort | cmp -s - tlist.lst && [ "$(cat mnt/fuse16/entry_with_a_long_name_for_replies_2999)" == LIST ] || {
+		echo "### Test KO", directory listing is different
+		rm -f tlist1 tlist.lst
+		kilfuse
+		exit 1
+	}
+	rm -f tlist1 tlist.lst
+	echo "*** Test OK"
+	remfuse
+}
+fuse17() {
+	echo Fuse: directory emptied while it is read:
+	echo GONE >tgone1
+	./fatx --as label $DSK -l XBOX --do "mkdir, /fuse17" >/dev/null 2>&1
+	for ((i = 0; i < 2000; i += 500)); do
+		cmd=""
+		for ((j = i; j < i + 500; j++)); do
+			cmd="$cmd rcp, tgone1, /fuse17/entry_removed_while_listed_$j;"
+		done
+		./fatx --as label $DSK -l XBOX --do "$cmd" >/dev/null 2>&1
+	done
+	prefuse
+	# each entry is removed as soon as it is read, between the getdents calls of readdir
+	perl -e 'opendir(D, $ARGV[0]) or die; while(defined($f = readdir(D))) { next if $f =~ /^\.\.?$/; unlink("$ARGV[0]/$f") or die; } closedir(D);' mnt/fuse17
+	[ $? == 0 ] && [ -z "$(ls -A mnt/fuse17)" ] || {
+		echo "### Test KO", entries skipped: $(ls -A mnt/fuse17 | wc -l)
+		rm -f tgone1
+		kilfuse
+		exit 1
+	}
+	rm -f tgone1
+	echo "*** Test OK"
+	remfuse
+}
+fuse18() {
+	echo Fuse: directory changes reach the device while mounted:
+	for mode in always close delay; do
+		prefuse "--sync $mode"
+		mkdir -p mnt/fuse18/$mode/dir
+		case $mode in
+		close)
+			echo SYNC >mnt/fuse18/$mode/f
+			;;
+		delay)
+			# changed directory clusters are written at most 5 seconds later
+			sleep 7
+			;;
+		esac
+		# the mount locks the image, a copy of it is read instead
+		cp $DSK tsync.fatx
+		rm -rf texp
+		./fatx --as label tsync.fatx --do "export, /fuse18, texp" >/dev/null 2>&1
+		[ -d texp/$mode/dir ] || {
+			echo "### Test KO", changes not on the device in $mode mode
+			rm -rf tsync.fatx texp
+			kilfuse
+			exit 1
+		}
+		remfuse
+	done
+	rm -rf tsync.fatx texp
+	echo "*** Test OK"
+}
+fuse19() {
+	echo Fuse: copies inside the device:
+	rm -f tcopy2
+	dd if=/dev/urandom of=tcopy1 bs=$((5 * 1024 * 1024 + 333)) count=1 >/dev/null 2>&1
+	for opt in "" --lowlevel; do
+		prefuse "$opt"
+		mkdir -p mnt/fuse19
+		cp tcopy1 mnt/fuse19/src
+		# cp asks copy_file_range first, served by copies between device extents
+		cp --reflink=never mnt/fuse19/src mnt/fuse19/dst
+		if which xfs_io >/dev/null 2>&1; then
+			# an unaligned range over the end of a file
+			dd if=/dev/zero of=mnt/fuse19/part bs=300000 count=1 >/dev/null 2>&1
+			xfs_io -c "copy_range -s 4097 -d 100000 -l 1000000 mnt/fuse19/src" mnt/fuse19/part
+			{ head -c 100000 /dev/zero; tail -c +4098 tcopy1 | head -c 1000000; } >tcopy2
+		fi
+		remfuse
+		prefuse "$opt"
+		cmp -s tcopy1 mnt/fuse19/dst && { [ ! -e tcopy2 ] || cmp -s tcopy2 mnt/fuse19/part; } || {
+			echo "### Test KO", copies are different $opt
+			rm -f tcopy1 tcopy2
+			kilfuse
+			exit 1
+		}
+		rm -rf mnt/fuse19 tcopy2
+		remfuse
+	done
+	rm -f tcopy1
+	echo "*** Test OK"
+}
 fuse99() {
 	echo Fuse: check statfs:
 	prefuse
@@ -508,6 +720,142 @@ unrm4() {
 	fi
 }
 
+copy1() {
+	echo Label: streamed copies: 
+	./fatx --as mkfs $DSK -vy
+	dd if=/dev/urandom of=tbff5 bs=$((5 * 1024 * 1024 + 333)) count=1 >/dev/null 2>&1
+	./fatx --as label $DSK -l XBOX -v --do "\
+		mkdir,	/copy1; \
+		rcp,	tbff5, /copy1/tbff5; \
+		cp,		/copy1/tbff5, /copy1/tbff5.cp; \
+		rm,		/copy1/tbff5; \
+	"
+	./fatx --as label $DSK -v --do "\
+		lcp,	/copy1/tbff5.cp, tbff5.bak; \
+	"
+	cmp -b tbff5 tbff5.bak
+	if [ $? == 0 ]; then
+		echo "*** Test OK"
+		rm tbff5 tbff5.bak
+	else
+		echo "### Test KO", files are different
+		exit 1
+	fi
+}
+
+mkfs2() {
+	echo Mkfs: populate from a directory: 
+	mkdir -p tpop/dir1/dir2 tpop/dir3
+	dd if=/dev/urandom of=tpop/dir1/dir2/tbff6 bs=$((3 * 1024 * 1024 + 777)) count=1 >/dev/null 2>&1
+	for i in $(seq 1 300); do echo $i > tpop/dir3/file$i; done
+	touch tpop/empty
+	./fatx --as mkfs $DSK -vy --populate tpop
+	if [ $? != 0 ]; then
+		echo "### Test KO", populate failed
+		exit 1
+	fi
+	./fsck.fatx -nv $DSK >/dev/null 2>&1
+	if [ $? != 0 ]; then
+		echo "### Test KO", filesystem not clean
+		exit 1
+	fi
+	./fatx --as label $DSK -v --do "\
+		lcp,	/dir1/dir2/tbff6, tbff6.bak; \
+		lcp,	/dir3/file300, file300.bak; \
+	"
+	cmp -b tpop/dir1/dir2/tbff6 tbff6.bak && cmp -b tpop/dir3/file300 file300.bak
+	if [ $? == 0 ]; then
+		echo "*** Test OK"
+		rm -f tbff6.bak file300.bak
+	else
+		echo "### Test KO", files are different
+		exit 1
+	fi
+}
+
+export1() {
+	echo Label: export a tree: 
+	./fatx --as label $DSK -v --do "\
+		export,	/, texp; \
+	"
+	# dates are kept to the minute
+	diff -r tpop texp >/dev/null 2>&1 && [ "$(stat -c %y tpop/dir3/file1 | cut -c1-16)" == "$(stat -c %y texp/dir3/file1 | cut -c1-16)" ]
+	if [ $? == 0 ]; then
+		echo "*** Test OK"
+		rm -rf tpop texp
+	else
+		echo "### Test KO", trees are different
+		exit 1
+	fi
+}
+
+tar1() {
+	echo Mkfs: populate from a tar stream, then write it back: 
+	mkdir -p tpop/dir1/dir2 tpop/dir3
+	dd if=/dev/urandom of=tpop/dir1/dir2/tbff7 bs=$((2 * 1024 * 1024 + 555)) count=1 >/dev/null 2>&1
+	for i in $(seq 1 50); do echo $i > tpop/dir3/file$i; done
+	(cd tpop && tar cf - .) | ./fatx --as mkfs $DSK -vy --populate -
+	if [ $? != 0 ]; then
+		echo "### Test KO", populate failed
+		exit 1
+	fi
+	mkdir -p texp
+	./fatx --as label $DSK --tar / | tar xf - -C texp
+	diff -r tpop texp
+	if [ $? == 0 ]; then
+		echo "*** Test OK"
+		rm -rf tpop texp
+	else
+		echo "### Test KO", trees are different
+		exit 1
+	fi
+}
+
+export2() {
+	echo Label: export skips names leading out of the tree: 
+	./fatx --as mkfs $DSK -vy
+	echo TEST >tbff8
+	./fatx --as label $DSK -l XBOX -v --do "\
+		rcp,	tbff8, /Q7pwnQ; \
+		rcp,	tbff8, /kept; \
+	"
+	# the entry is renamed on the image, as a crafted one would be
+	off=$(grep -obUa Q7pwnQ $DSK | head -1 | cut -f1 -d:)
+	printf '../pwn' | dd of=$DSK bs=1 seek=$off conv=notrunc >/dev/null 2>&1
+	rm -rf texp pwn
+	./fatx --as label $DSK -v --do "\
+		export,	/, texp; \
+	"
+	if [ ! -e pwn ] && [ -e texp/kept ]; then
+		echo "*** Test OK"
+		rm -rf texp tbff8
+	else
+		echo "### Test KO", file written out of the tree
+		rm -f pwn
+		exit 1
+	fi
+}
+
+tar2() {
+	echo Mkfs: tar members out of the tree are refused: 
+	rm -rf ttar
+	mkdir -p ttar/a
+	echo TEST >ttar/f
+	echo TEST >ttar/b
+	echo TEST >ttar/g
+	tar -C ttar -P --transform='s,^f$,../up,;s,^b$,a/../b,;s,^g$,/abs,' -cf tbff9.tar f a b g
+	./fatx --as mkfs $DSK -vy --populate - <tbff9.tar
+	./fatx --as label $DSK --tar / | tar tf - >tbff9.ls
+	if [ "$(cat tbff9.ls)" == "a/" ]; then
+		echo "*** Test OK"
+		rm -rf ttar tbff9.tar tbff9.ls
+	else
+		echo "### Test KO", members out of the tree copied
+		cat tbff9.ls
+		exit 1
+	fi
+}
+
 close() {
 	remove
 	rm $DSK
@@ -539,6 +887,133 @@ scenario() {
 	sleep $WAIT
 	fusermount -u mnt
 }
+case1() {
+	echo Label: names in another case:
+	./fatx --as mkfs $DSK -vy
+	echo ONE >tcase1
+	echo TWO >tcase2
+	out=$(./fatx --as label $DSK -l XBOX -v --do "\
+		mkdir,	/case1; \
+		rcp,	tcase1, /case1/Foo; \
+		rcp,	tcase2, /case1/foo; \
+		mkdir,	/case1/FOO; \
+		lcp,	/case1/FOO, tcase.bak; \
+	" 2>&1)
+	[ $(echo "$out" | grep -c exists) == 2 ] && cmp -s tcase1 tcase.bak || {
+		echo "### Test KO", same name added twice
+		echo "$out"
+		rm -f tcase1 tcase2 tcase.bak
+		exit 1
+	}
+	./fsck.fatx -nv $DSK >/dev/null 2>&1 || {
+		echo "### Test KO", filesystem not clean
+		rm -f tcase1 tcase2 tcase.bak
+		exit 1
+	}
+	rm -f tcase1 tcase2 tcase.bak
+	echo "*** Test OK"
+}
+jump1() {
+	echo Label: reads in a fragmented chain:
+	./fatx --as mkfs $DSK -vy
+	dd if=/dev/urandom of=tjmp1 bs=1M count=1 >/dev/null 2>&1
+	dd if=/dev/urandom of=tjmp2 bs=1M count=40 >/dev/null 2>&1
+	# the volume is filled, then one file in two is removed: the free space is only holes
+	cmd="mkdir, /jump1;"
+	for ((i = 0; i < $SIZE; i++)); do
+		cmd="$cmd rcp, tjmp1, /jump1/f$i;"
+	done
+	./fatx --as label $DSK -l XBOX --do "$cmd" >/dev/null 2>&1
+	cmd=""
+	for ((i = 0; i < $SIZE; i += 2)); do
+		cmd="$cmd rm, /jump1/f$i;"
+	done
+	./fatx --as label $DSK -l XBOX --do "$cmd" >/dev/null 2>&1
+	./fatx --as label $DSK -l XBOX -v --do "\
+		rcp,	tjmp2, /jump1/big; \
+		cp,		/jump1/big, /jump1/big.cp; \
+		rm,		/jump1/f1; \
+	"
+	./fatx --as label $DSK -v --do "\
+		lcp,	/jump1/big.cp, tjmp.bak; \
+	"
+	cmp -s tjmp2 tjmp.bak && ./fsck.fatx -nv $DSK >/dev/null 2>&1 || {
+		echo "### Test KO", fragmented file is different
+		rm -f tjmp1 tjmp2 tjmp.bak
+		exit 1
+	}
+	rm -f tjmp1 tjmp2 tjmp.bak
+	echo "*** Test OK"
+}
+hole1() {
+	echo Label: entries added in place of removed ones:
+	./fatx --as mkfs $DSK -vy
+	echo HOLE >thole1
+	cmd="mkdir, /hole1;"
+	for ((i = 0; i < 1000; i++)); do
+		cmd="$cmd rcp, thole1, /hole1/f$i;"
+	done
+	./fatx --as label $DSK -l XBOX --do "$cmd" >/dev/null 2>&1
+	before=$(./fatx --as label $DSK --do "lsfat, /hole1" 2>&1 | grep ^/hole1)
+	# slots freed in the same run, then slots found again when the directory is read
+	cmd=""
+	for ((i = 0; i < 300; i++)); do
+		cmd="$cmd rm, /hole1/f$i; rcp, thole1, /hole1/g$i;"
+	done
+	./fatx --as label $DSK -l XBOX --do "$cmd" >/dev/null 2>&1
+	cmd=""
+	for ((i = 300; i < 500; i++)); do
+		cmd="$cmd rm, /hole1/f$i;"
+	done
+	./fatx --as label $DSK -l XBOX --do "$cmd" >/dev/null 2>&1
+	cmd=""
+	for ((i = 0; i < 200; i++)); do
+		cmd="$cmd rcp, thole1, /hole1/h$i;"
+	done
+	./fatx --as label $DSK -l XBOX --do "$cmd" >/dev/null 2>&1
+	after=$(./fatx --as label $DSK --do "lsfat, /hole1" 2>&1 | grep ^/hole1)
+	./fatx --as label $DSK --do "\
+		lcp,	/hole1/g299, thole.g; \
+		lcp,	/hole1/h199, thole.h; \
+		lcp,	/hole1/f999, thole.f; \
+	" >/dev/null 2>&1
+	[ -n "$before" ] && [ "$before" == "$after" ] && cmp -s thole1 thole.g && cmp -s thole1 thole.h && cmp -s thole1 thole.f || {
+		echo "### Test KO", directory grew or entries are lost
+		echo "$before"
+		echo "$after"
+		rm -f thole1 thole.g thole.h thole.f
+		exit 1
+	}
+	./fsck.fatx -nv $DSK >/dev/null 2>&1 || {
+		echo "### Test KO", filesystem not clean
+		rm -f thole1 thole.g thole.h thole.f
+		exit 1
+	}
+	rm -f thole1 thole.g thole.h thole.f
+	echo "*** Test OK"
+}
+date1() {
+	echo Mkfs: dates through the volume:
+	rm -rf tdate texp
+	mkdir tdate
+	# seconds under 32, kept as they are by the entries
+	dates=("1999-12-31 23:59:10" "2000-02-29 12:00:00" "2016-07-14 03:04:05" "2037-01-01 00:00:30")
+	for ((i = 0; i < ${#dates[*]}; i++)); do
+		echo $i >tdate/f$i
+		touch -d "${dates[$i]}" tdate/f$i
+	done
+	./fatx --as mkfs $DSK -vy --populate tdate >/dev/null 2>&1
+	./fatx --as label $DSK -l XBOX --do "export, /, texp" >/dev/null 2>&1
+	for ((i = 0; i < ${#dates[*]}; i++)); do
+		[ "$(stat -c %Y tdate/f$i)" == "$(stat -c %Y texp/f$i)" ] || {
+			echo "### Test KO", f$i dated $(stat -c %y texp/f$i) instead of ${dates[$i]}
+			rm -rf tdate texp
+			exit 1
+		}
+	done
+	rm -rf tdate texp
+	echo "*** Test OK"
+}
 
 tests=(
 	close
@@ -565,6 +1040,23 @@ tests=(
 	fuse99
 	fsck1
 	unrm4
+	copy1
+	mkfs2
+	export1
+	tar1
+	export2
+	tar2
+	fuse15
+	case1
+	jump1
+	hole1
+	fuse16
+	date1
+	fuse17
+	fuse13
+	fuse14
+	fuse18
+	fuse19
 )
 testn=`basename $0`
 
@@ -100,6 +100,9 @@ bool						frontend::		getanswer(bool def) {
 	fuse_debug(false),
 	fuse_foregrd(false),
 	fuse_singlethr(false),
+	fuse_lowlevel(false),
+	fuse_threads(0),
+	fuse_timeout(def_ll_timeout),
 	nofat(false),
 	argc(ac),
 	argv(av),
@@ -127,6 +130,8 @@ bool						frontend::		getanswer(bool def) {
 	allyes(true),
 	offset(0),
 	size(0),
+	cache_size(def_cache),
+	snapdir(),
 	input(drive) {
 }
 